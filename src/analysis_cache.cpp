@@ -0,0 +1,301 @@
+#include "analysis_cache.hpp"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+namespace {
+// Bump the version when the file layout or the analysis itself changes.
+constexpr char kMagic[8] = {'W', 'A', 'V', 'E', 'Y', 'A', 'C', '1'};
+constexpr char kExtension[] = ".cache";
+// Every part of an entry starts at a multiple of this, so mapped data is aligned for SIMD loads.
+constexpr size_t kAlignment = 16;
+constexpr uint64_t kMaxCacheSize = 4ull << 30;
+constexpr uint64_t kTrimInterval = 64 << 20;
+
+size_t Padded(size_t size) {
+    return (size + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+// 64-bit FNV-1a, which unlike std::hash is the same for every build.
+uint64_t Hash(const std::string& s) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const char c : s) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+std::string WaveformKey(const std::string& file_identity) {
+    return "waveform " + std::to_string(LowResWaveform::kFirstLevelFactor) + " " +
+           std::to_string(LowResWaveform::kLevelFactor) + "\n" + file_identity;
+}
+
+std::string SpectrogramTileKey(const std::string& file_identity,
+                               const SpectrogramSettings& settings,
+                               int tile) {
+    return "spectrogram " + std::to_string(settings.fft_size) + " " +
+           std::to_string(settings.hop) + " " + settings.WindowName() + " " +
+           std::to_string(Spectrogram::kSpectraPerTile) + " " + std::to_string(tile) + "\n" +
+           file_identity;
+}
+
+bool WriteAll(int fd, const void* data, size_t size) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    while (size) {
+        const ssize_t written = write(fd, p, size);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += written;
+        size -= written;
+    }
+    return true;
+}
+
+// Sequential reads of aligned parts from a mapped entry.
+class Reader {
+   public:
+    Reader(const MappedFile& file, size_t offset)
+        : data(file.Data()), size(file.Size()), pos(offset) {}
+
+    // Return nullptr if the entry is too short.
+    template <typename T>
+    const T* Read(uint64_t count) {
+        if (pos > size || count > (size - pos) / sizeof(T))
+            return nullptr;
+        const T* p = reinterpret_cast<const T*>(data + pos);
+        pos += Padded(count * sizeof(T));
+        return p;
+    }
+
+    size_t Position() const { return pos; }
+
+   private:
+    const uint8_t* data;
+    size_t size;
+    size_t pos;
+};
+}  // namespace
+
+AnalysisCache::AnalysisCache() : directory(DefaultDirectory()) {}
+
+std::string AnalysisCache::DefaultDirectory() {
+    std::string base;
+    const char* xdg_cache_home = std::getenv("XDG_CACHE_HOME");
+    const char* home = std::getenv("HOME");
+    if (xdg_cache_home && xdg_cache_home[0] == '/') {
+        base = xdg_cache_home;
+    } else if (home && home[0]) {
+        base = std::string(home) + "/.cache";
+    } else {
+        return "";
+    }
+    const std::string directory = base + "/wavey";
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+    return ec ? "" : directory;
+}
+
+std::unique_ptr<LowResWaveform> AnalysisCache::LoadWaveform(
+    const std::string& file_identity) const {
+    size_t offset;
+    std::unique_ptr<MappedFile> file = Load(WaveformKey(file_identity), &offset);
+    if (!file)
+        return nullptr;
+
+    // Number of channels and levels, followed by the number of floats on each level.
+    Reader reader(*file, offset);
+    const uint64_t* header = reader.Read<uint64_t>(2);
+    if (!header || header[0] == 0 || header[0] > INT_MAX)
+        return nullptr;
+    const int num_channels = header[0];
+    const uint64_t* sizes = reader.Read<uint64_t>(header[1]);
+    if (!sizes)
+        return nullptr;
+
+    std::vector<LowResWaveform::Level> levels;
+    for (uint64_t level = 0; level < header[1]; level++) {
+        const float* data = reader.Read<float>(sizes[level]);
+        if (!data || sizes[level] % (2 * num_channels))
+            return nullptr;
+        levels.push_back({data, sizes[level]});
+    }
+    return std::make_unique<LowResWaveform>(std::move(file), num_channels, std::move(levels));
+}
+
+std::shared_ptr<const Spectrogram::Tile> AnalysisCache::LoadSpectrogramTile(
+    const std::string& file_identity,
+    const SpectrogramSettings& settings,
+    int tile,
+    int num_channels,
+    int num_spectra) const {
+    size_t offset;
+    std::unique_ptr<MappedFile> file =
+        Load(SpectrogramTileKey(file_identity, settings, tile), &offset);
+    if (!file)
+        return nullptr;
+
+    // Number of channels, spectra and bins per spectrum, followed by the spectra.
+    Reader reader(*file, offset);
+    const uint64_t* header = reader.Read<uint64_t>(3);
+    if (!header || header[0] != static_cast<uint64_t>(num_channels) ||
+        header[1] != static_cast<uint64_t>(num_spectra) ||
+        header[2] != static_cast<uint64_t>(settings.OutputSize()))
+        return nullptr;
+    const uint16_t* data = reader.Read<uint16_t>(header[0] * header[1] * header[2]);
+    if (!data)
+        return nullptr;
+    return std::make_shared<Spectrogram::Tile>(std::move(file), data, num_channels, num_spectra,
+                                               settings.OutputSize());
+}
+
+void AnalysisCache::StoreWaveform(const std::string& file_identity,
+                                  const LowResWaveform& waveform) const {
+    if (file_identity.empty() || !waveform.NumChannels())
+        return;
+    const uint64_t header[2] = {static_cast<uint64_t>(waveform.NumChannels()),
+                                static_cast<uint64_t>(waveform.NumLevels())};
+    std::vector<uint64_t> sizes;
+    for (int level = 0; level < waveform.NumLevels(); level++) {
+        sizes.push_back(waveform.ComputedSize(level));
+    }
+
+    std::vector<Part> payload = {{header, sizeof(header)},
+                                 {sizes.data(), sizes.size() * sizeof(uint64_t)}};
+    for (int level = 0; level < waveform.NumLevels(); level++) {
+        payload.push_back({waveform.Data(level), waveform.ComputedSize(level) * sizeof(float)});
+    }
+    Store(WaveformKey(file_identity), payload);
+}
+
+void AnalysisCache::StoreSpectrogramTile(const std::string& file_identity,
+                                         const SpectrogramSettings& settings,
+                                         int tile,
+                                         const Spectrogram::Tile& data) const {
+    if (file_identity.empty() || !data.NumChannels())
+        return;
+    const uint64_t header[3] = {static_cast<uint64_t>(data.NumChannels()),
+                                static_cast<uint64_t>(data.NumSpectra()),
+                                static_cast<uint64_t>(data.OutputSize())};
+    // The spectra of all channels are contiguous.
+    Store(SpectrogramTileKey(file_identity, settings, tile),
+          {{header, sizeof(header)}, {data.Data(0, 0), data.Bytes()}});
+}
+
+std::string AnalysisCache::EntryPath(const std::string& key) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%016llx", static_cast<unsigned long long>(Hash(key)));
+    return directory + name + kExtension;
+}
+
+std::unique_ptr<MappedFile> AnalysisCache::Load(const std::string& key,
+                                                size_t* payload_offset) const {
+    if (directory.empty())
+        return nullptr;
+    const std::string path = EntryPath(key);
+    std::unique_ptr<MappedFile> file = MappedFile::Open(path);
+    if (!file)
+        return nullptr;
+
+    // Check the stored key, since different keys may hash to the same entry.
+    Reader reader(*file, 0);
+    const char* magic = reader.Read<char>(sizeof(kMagic));
+    if (!magic || std::memcmp(magic, kMagic, sizeof(kMagic)) != 0)
+        return nullptr;
+    const uint64_t* key_size = reader.Read<uint64_t>(1);
+    if (!key_size || *key_size != key.size())
+        return nullptr;
+    const char* stored_key = reader.Read<char>(*key_size);
+    if (!stored_key || key.compare(0, key.size(), stored_key, *key_size) != 0)
+        return nullptr;
+    *payload_offset = reader.Position();
+
+    // The modification time of an entry is its last use.
+    utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+    return file;
+}
+
+void AnalysisCache::Store(const std::string& key, const std::vector<Part>& payload) const {
+    if (directory.empty())
+        return;
+
+    // Write to a temporary file that is renamed when complete, so that a partial entry is never
+    // seen by another load, even from another instance of wavey.
+    std::string tmp_path = directory + "/tmp-XXXXXX";
+    const int fd = mkstemp(&tmp_path[0]);
+    if (fd < 0)
+        return;
+
+    const uint64_t key_size = key.size();
+    std::vector<Part> parts = {
+        {kMagic, sizeof(kMagic)}, {&key_size, sizeof(key_size)}, {key.data(), key.size()}};
+    parts.insert(parts.end(), payload.begin(), payload.end());
+
+    static const uint8_t kZeros[kAlignment] = {};
+    bool ok = true;
+    for (const Part& part : parts) {
+        ok = ok && WriteAll(fd, part.first, part.second) &&
+             WriteAll(fd, kZeros, Padded(part.second) - part.second);
+    }
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(tmp_path.c_str(), EntryPath(key).c_str()) != 0) {
+        std::cerr << "AnalysisCache: Failed to write " << tmp_path << std::endl;
+        unlink(tmp_path.c_str());
+        return;
+    }
+
+    // Entries are small compared to the cache, so the size is only checked now and then.
+    uint64_t written = Padded(key.size()) + 32;
+    for (const Part& part : payload) {
+        written += Padded(part.second);
+    }
+    if (bytes_since_trim.fetch_add(written) + written >= kTrimInterval) {
+        bytes_since_trim = 0;
+        Trim();
+    }
+}
+
+void AnalysisCache::Trim() const {
+    namespace fs = std::filesystem;
+    struct Entry {
+        fs::path path;
+        fs::file_time_type last_use;
+        uintmax_t size;
+    };
+    std::vector<Entry> entries;
+    uintmax_t total_size = 0;
+
+    std::error_code ec;
+    for (const fs::directory_entry& e : fs::directory_iterator(directory, ec)) {
+        if (e.path().extension() != kExtension)
+            continue;
+        Entry entry = {e.path(), e.last_write_time(ec), e.file_size(ec)};
+        if (ec)
+            continue;
+        total_size += entry.size;
+        entries.push_back(std::move(entry));
+    }
+    if (total_size <= kMaxCacheSize)
+        return;
+
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry& a, const Entry& b) { return a.last_use < b.last_use; });
+    for (const Entry& entry : entries) {
+        if (total_size <= kMaxCacheSize)
+            break;
+        // An entry that is mapped by a track stays valid until it is unmapped.
+        if (fs::remove(entry.path, ec)) {
+            total_size -= entry.size;
+        }
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef ANALYSIS_CACHE_HPP
+#define ANALYSIS_CACHE_HPP
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "low_res_waveform.hpp"
+#include "mapped_file.hpp"
+#include "spectrogram.hpp"
+
+// On-disk cache of analysis results in $XDG_CACHE_HOME/wavey. An entry is keyed by the identity of
+// the audio file (path, size and modification time) together with the analysis parameters, and is
+// memory-mapped when loaded, so reopening a known file skips both the min/max and the FFT passes.
+class AnalysisCache {
+   public:
+    AnalysisCache();
+    // $XDG_CACHE_HOME/wavey, created if missing. Empty if there is no usable cache directory.
+    static std::string DefaultDirectory();
+
+    // Return nullptr if there is no valid entry.
+    std::unique_ptr<LowResWaveform> LoadWaveform(const std::string& file_identity) const;
+    std::shared_ptr<const Spectrogram::Tile> LoadSpectrogramTile(
+        const std::string& file_identity,
+        const SpectrogramSettings& settings,
+        int tile,
+        int num_channels,
+        int num_spectra) const;
+
+    void StoreWaveform(const std::string& file_identity, const LowResWaveform& waveform) const;
+    void StoreSpectrogramTile(const std::string& file_identity,
+                              const SpectrogramSettings& settings,
+                              int tile,
+                              const Spectrogram::Tile& data) const;
+
+   private:
+    // A range of bytes to write.
+    using Part = std::pair<const void*, size_t>;
+
+    std::string EntryPath(const std::string& key) const;
+    // Map an entry and return the offset of its payload, which follows the stored key.
+    std::unique_ptr<MappedFile> Load(const std::string& key, size_t* payload_offset) const;
+    void Store(const std::string& key, const std::vector<Part>& payload) const;
+    // Remove the least recently used entries when the cache grows too large.
+    void Trim() const;
+
+    // Empty if there is no usable cache directory.
+    std::string directory;
+    // Bytes stored since the cache size was last checked.
+    mutable std::atomic<uint64_t> bytes_since_trim{0};
+};
+
+#endif
@@ -1,27 +1,454 @@
 #include "audio_buffer.hpp"
+#include <sys/stat.h>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <new>
 #include <sndfile.hh>
 
+#include "sample_convert.hpp"
+
+namespace {
+// Decoded files are split into chunks of this many frames when decoded in parallel.
+constexpr int64_t kFramesPerChunk = 1 << 20;
+
+uint32_t ReadLe32(const uint8_t* p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+uint64_t ReadLe64(const uint8_t* p) {
+    return ReadLe32(p) | static_cast<uint64_t>(ReadLe32(p + 4)) << 32;
+}
+
+// Find the sample data of a RIFF or RF64 WAVE file.
+bool FindWavData(const MappedFile& file, size_t* data_offset, uint64_t* data_size) {
+    const uint8_t* p = file.Data();
+    const size_t size = file.Size();
+    if (size < 12 || std::memcmp(p + 8, "WAVE", 4) != 0)
+        return false;
+    const bool rf64 = std::memcmp(p, "RF64", 4) == 0;
+    if (!rf64 && std::memcmp(p, "RIFF", 4) != 0)
+        return false;
+
+    uint64_t ds64_data_size = 0;
+    size_t pos = 12;
+    while (pos + 8 <= size) {
+        const uint8_t* chunk = p + pos;
+        uint64_t chunk_size = ReadLe32(chunk + 4);
+        if (std::memcmp(chunk, "ds64", 4) == 0 && chunk_size >= 16 && pos + 8 + 16 <= size) {
+            // RIFF size followed by data size.
+            ds64_data_size = ReadLe64(chunk + 8 + 8);
+        } else if (std::memcmp(chunk, "data", 4) == 0) {
+            if (rf64 && chunk_size == 0xffffffff) {
+                chunk_size = ds64_data_size;
+            } else if (!rf64 && (chunk_size == 0 || chunk_size == 0xffffffff)) {
+                // Placeholder size of a recording that was not finalized. libsndfile knows how to
+                // recover the length of these.
+                return false;
+            }
+            *data_offset = pos + 8;
+            *data_size = std::min<uint64_t>(chunk_size, size - *data_offset);
+            return true;
+        }
+        // Chunks are padded to an even number of bytes.
+        pos += 8 + chunk_size + (chunk_size & 1);
+    }
+    return false;
+}
+
+std::string GetFileIdentity(const std::string& file_name) {
+    struct stat statbuf;
+    if (stat(file_name.c_str(), &statbuf) != 0)
+        return "";
+    char path[PATH_MAX];
+    const char* canonical = realpath(file_name.c_str(), path) ? path : file_name.c_str();
+    return std::string(canonical) + "\n" + std::to_string(statbuf.st_size) + "\n" +
+           std::to_string(statbuf.st_mtim.tv_sec) + "." + std::to_string(statbuf.st_mtim.tv_nsec);
+}
+
+// Little-endian PCM to float, scaled the same way as libsndfile does.
+template <int kBytesPerSample>
+float PcmToFloat(const uint8_t* p);
+
+template <>
+float PcmToFloat<2>(const uint8_t* p) {
+    return static_cast<int16_t>(p[0] | p[1] << 8) * (1.f / 32768.f);
+}
+
+template <>
+float PcmToFloat<3>(const uint8_t* p) {
+    const int32_t s =
+        static_cast<int32_t>(p[0] << 8 | p[1] << 16 | static_cast<uint32_t>(p[2]) << 24);
+    return (s >> 8) * (1.f / 8388608.f);
+}
+
+template <>
+float PcmToFloat<4>(const uint8_t* p) {
+    return static_cast<int32_t>(ReadLe32(p)) * (1.f / 2147483648.f);
+}
+
+// Decoding to 16-bit integers is lossless for these.
+bool IsInt16(int format) {
+    switch (format & SF_FORMAT_SUBMASK) {
+        case SF_FORMAT_PCM_S8:
+        case SF_FORMAT_PCM_U8:
+        case SF_FORMAT_PCM_16:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Read up to |count| frames of |type| directly into |dest|, calling |progress| with the number of
+// frames read so far after each read. Returns the number of frames read.
+template <class F>
+int64_t ReadFrames(SndfileHandle& file,
+                   SampleType type,
+                   void* dest,
+                   int num_channels,
+                   int64_t count,
+                   const CancellationToken& cancel,
+                   F progress) {
+    // Large reads, with progress reported often enough for the display to follow.
+    constexpr int64_t kFramesPerRead = 1 << 16;
+    int64_t frames_read = 0;
+    while (frames_read < count && !cancel.Cancelled()) {
+        const int64_t offset = frames_read * num_channels;
+        const int64_t frames = std::min(kFramesPerRead, count - frames_read);
+        const int64_t n = type == INT16
+                              ? file.readf(static_cast<short*>(dest) + offset, frames)
+                              : file.readf(static_cast<float*>(dest) + offset, frames);
+        if (n <= 0)
+            break;
+        frames_read += n;
+        progress(frames_read);
+    }
+    return frames_read;
+}
+
+template <int kBytesPerSample>
+void ConvertPcm(const uint8_t* src, float* dst, size_t num_samples) {
+    for (size_t i = 0; i < num_samples; i++) {
+        dst[i] = PcmToFloat<kBytesPerSample>(src);
+        src += kBytesPerSample;
+    }
+}
+}  // namespace
+
+bool SeeksExactly(SndfileHandle& file) {
+    switch (file.format() & SF_FORMAT_TYPEMASK) {
+        case SF_FORMAT_WAV:
+        case SF_FORMAT_WAVEX:
+        case SF_FORMAT_RF64:
+        case SF_FORMAT_W64:
+        case SF_FORMAT_AIFF:
+        case SF_FORMAT_CAF:
+        case SF_FORMAT_FLAC:
+            break;
+        default:
+            return false;
+    }
+    const sf_count_t middle = file.frames() / 2;
+    const bool seekable = file.seek(middle, SEEK_SET) == middle;
+    file.seek(0, SEEK_SET);
+    return seekable;
+}
+
 AudioBuffer::AudioBuffer(std::string file_name) {
+    // Identify the file before reading it. If it is modified while being read, the newer
+    // modification time keeps later loads from using analysis results cached for this one.
+    file_identity = GetFileIdentity(file_name);
+    this->file_name = file_name;
+
     // Open file.
-    SndfileHandle file(file_name);
-    if (!file || file.samplerate() == 0)
+    auto file = std::make_unique<SndfileHandle>(file_name);
+    if (!*file || file->samplerate() == 0) {
+        loaded = true;
+        return;
+    }
+
+    samplerate = file->samplerate();
+    num_channels = file->channels();
+    format = file->format();
+    streamable =
+        file->frames() > 0 && file->frames() != SF_COUNT_MAX && SeeksExactly(*file);
+    if (OpenMapped(file_name, file->frames()))
+        return;
+
+    sample_type = IsInt16(format) ? INT16 : FLOAT32;
+    if (file->frames() <= 0 || file->frames() == SF_COUNT_MAX) {
+        ReadStream(*file);
         return;
+    }
+
+    // The samples are allocated once for the length in the header, so that they are never moved
+    // while loaded frames are in use.
+    num_frames = file->frames();
+    AllocateSamples(num_frames);
+    decoded_file = std::move(file);
+}
+
+AudioBuffer::~AudioBuffer() = default;
+
+void AudioBuffer::Load(const CancellationToken& cancel, int max_decoders) {
+    if (decoded_file) {
+        LoadDecoded(cancel, max_decoders);
+        decoded_file.reset();
+    } else if (bytes_per_sample) {
+        LoadMapped(cancel);
+    }
+    if (!cancel.Cancelled()) {
+        loaded_frames.store(num_frames, std::memory_order_release);
+        loaded.store(true, std::memory_order_release);
+    }
+}
+
+bool AudioBuffer::OpenMapped(const std::string& file_name, int64_t frames) {
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+    return false;
+#else
+    const int type = format & SF_FORMAT_TYPEMASK;
+    if (type != SF_FORMAT_WAV && type != SF_FORMAT_WAVEX && type != SF_FORMAT_RF64)
+        return false;
+    if ((format & SF_FORMAT_ENDMASK) == SF_ENDIAN_BIG)
+        return false;
+
+    int sample_size;
+    switch (format & SF_FORMAT_SUBMASK) {
+        case SF_FORMAT_PCM_16:
+            sample_size = 2;
+            break;
+        case SF_FORMAT_PCM_24:
+            sample_size = 3;
+            break;
+        case SF_FORMAT_PCM_32:
+        case SF_FORMAT_FLOAT:
+            sample_size = 4;
+            break;
+        default:
+            return false;
+    }
+
+    std::unique_ptr<MappedFile> mapped = MappedFile::Open(file_name);
+    uint64_t data_size;
+    if (!mapped || !FindWavData(*mapped, &data_offset, &data_size))
+        return false;
+
+    num_frames = std::min<uint64_t>(frames, data_size / (sample_size * num_channels));
+    mapped_file = std::move(mapped);
+
+    // Float and 16-bit samples are used in place. Pages are read from disk when they are first
+    // touched.
+    const int subformat = format & SF_FORMAT_SUBMASK;
+    if (subformat == SF_FORMAT_FLOAT && data_offset % alignof(float) == 0) {
+        sample_data = mapped_file->Data() + data_offset;
+        return true;
+    }
+    if (subformat == SF_FORMAT_PCM_16 && data_offset % alignof(int16_t) == 0) {
+        sample_type = INT16;
+        sample_data = mapped_file->Data() + data_offset;
+        return true;
+    }
+
+    // Integer PCM is converted by Load().
+    bytes_per_sample = sample_size;
+    AllocateSamples(num_frames);
+    return true;
+#endif
+}
+
+void AudioBuffer::ReadStream(SndfileHandle& file) {
+    // Streams are read to the end before the buffer is used, since the samples move as they grow.
+    constexpr int64_t kMinFrames = 1 << 16;
+    const size_t frame_size = num_channels * SampleSize();
+    int64_t capacity = 0;
+    int64_t frames = 0;
+    while (true) {
+        if (frames == capacity) {
+            capacity = std::max(2 * capacity, kMinFrames);
+            void* grown = std::realloc(samples.get(), capacity * frame_size);
+            if (!grown)
+                throw std::bad_alloc();
+            samples.release();
+            samples.reset(grown);
+        }
+        frames += ReadFrames(file, sample_type, MutableFrame(frames), num_channels,
+                             capacity - frames, {}, [](int64_t) {});
+        if (frames < capacity)
+            break;
+    }
+
+    sample_data = samples.get();
+    num_frames = frames;
+    loaded_frames = frames;
+    loaded = true;
+}
+
+void AudioBuffer::AllocateSamples(int64_t frames) {
+    // Large blocks are mapped from the system, zeroed, without calloc() writing to them.
+    samples.reset(std::calloc(std::max<int64_t>(frames, 1) * num_channels, SampleSize()));
+    if (!samples)
+        throw std::bad_alloc();
+    sample_data = samples.get();
+}
+
+void AudioBuffer::ReadFloat(int64_t first_frame, int64_t count, float* dest) const {
+    const int64_t offset = first_frame * num_channels;
+    if (sample_type == INT16) {
+        Int16ToFloat(static_cast<const int16_t*>(sample_data) + offset, count * num_channels, dest);
+    } else {
+        const float* src = static_cast<const float*>(sample_data) + offset;
+        std::copy(src, src + count * num_channels, dest);
+    }
+}
+
+void AudioBuffer::LoadMapped(const CancellationToken& cancel) {
+    // Integer PCM is converted up front into a float copy of the whole file, 4/3 the size of 24-bit
+    // data and as large as 32-bit data, since every consumer reads the samples through one
+    // pointer. Only the mapping stays out of memory: it is converted block by block and converted
+    // blocks are released. Blocks are converted in parallel, a batch at a time, and published
+    // after each batch.
+    constexpr int64_t kFramesPerBlock = 1 << 16;
+    constexpr int64_t kBlocksPerBatch = 64;
+    const size_t frame_size = bytes_per_sample * num_channels;
+    const int64_t frames = num_frames;
+    const int64_t num_blocks = (frames + kFramesPerBlock - 1) / kFramesPerBlock;
+    for (int64_t batch = 0; batch < num_blocks; batch += kBlocksPerBatch) {
+        const int64_t batch_blocks = std::min(kBlocksPerBatch, num_blocks - batch);
+        TaskScheduler::ParallelFor(batch_blocks, [&](int64_t i) {
+            if (cancel.Cancelled())
+                return;
+            const int64_t first_frame = (batch + i) * kFramesPerBlock;
+            const int64_t block_frames = std::min(kFramesPerBlock, frames - first_frame);
+            const size_t src_offset = data_offset + first_frame * frame_size;
+            const uint8_t* src = mapped_file->Data() + src_offset;
+            float* dst = static_cast<float*>(MutableFrame(first_frame));
+            const size_t num_samples = block_frames * num_channels;
+            switch (bytes_per_sample) {
+                case 2:
+                    ConvertPcm<2>(src, dst, num_samples);
+                    break;
+                case 3:
+                    ConvertPcm<3>(src, dst, num_samples);
+                    break;
+                case 4:
+                    ConvertPcm<4>(src, dst, num_samples);
+                    break;
+            }
+            mapped_file->Release(src_offset, block_frames * frame_size);
+        });
+        if (cancel.Cancelled())
+            return;
+        loaded_frames.store(std::min((batch + batch_blocks) * kFramesPerBlock, frames),
+                            std::memory_order_release);
+    }
+    mapped_file.reset();
+}
+
+void AudioBuffer::LoadDecoded(const CancellationToken& cancel, int max_decoders) {
+    const int64_t frames = num_frames;
+    const int64_t num_chunks = (frames + kFramesPerChunk - 1) / kFramesPerChunk;
+    const int64_t num_decoders =
+        std::min<int64_t>(num_chunks, max_decoders > 0 ? max_decoders : INT_MAX);
+
+    int64_t frames_read;
+    if (num_decoders > 1 && streamable) {
+        frames_read = LoadDecodedChunks(cancel, num_decoders);
+    } else {
+        frames_read =
+            ReadFrames(*decoded_file, sample_type, samples.get(), num_channels, frames, cancel,
+                       [this](int64_t n) { loaded_frames.store(n, std::memory_order_release); });
+    }
+
+    // The header may promise more frames than there are.
+    if (!cancel.Cancelled() && frames_read < frames) {
+        num_frames = frames_read;
+    }
+}
+
+int64_t AudioBuffer::LoadDecodedChunks(const CancellationToken& cancel, int num_decoders) {
+    const int64_t frames = num_frames;
+    const int64_t num_chunks = (frames + kFramesPerChunk - 1) / kFramesPerChunk;
+
+    // Chunks are handed out in order, so that the frames loaded from the start grow steadily. They
+    // are published up to the first chunk that is not fully decoded.
+    std::atomic<int64_t> next_chunk{0};
+    std::atomic<bool> seek_failed{false};
+    std::mutex mutex;
+    std::vector<int64_t> chunk_frames(num_chunks, 0);
+    int64_t complete_chunks = 0;
+    auto publish = [&](int64_t chunk, int64_t n) {
+        std::scoped_lock lock(mutex);
+        chunk_frames[chunk] = n;
+        while (complete_chunks < num_chunks &&
+               chunk_frames[complete_chunks] ==
+                   std::min(kFramesPerChunk, frames - complete_chunks * kFramesPerChunk)) {
+            complete_chunks++;
+        }
+        int64_t prefix = complete_chunks * kFramesPerChunk;
+        if (complete_chunks < num_chunks) {
+            prefix += chunk_frames[complete_chunks];
+        }
+        loaded_frames.store(std::min(prefix, frames), std::memory_order_release);
+    };
+
+    TaskScheduler::ParallelFor(num_decoders, [&](int64_t decoder) {
+        // A handle has a single read position, so every decoder opens the file.
+        std::unique_ptr<SndfileHandle> own_file;
+        SndfileHandle* file = decoded_file.get();
+        if (decoder) {
+            own_file = OpenDecoder();
+            file = own_file.get();
+        }
+        // The chunks are left to the other decoders if the file cannot be opened again.
+        if (!file || !*file)
+            return;
+        for (int64_t chunk = next_chunk++; chunk < num_chunks; chunk = next_chunk++) {
+            if (cancel.Cancelled())
+                return;
+            const int64_t first_frame = chunk * kFramesPerChunk;
+            const int64_t count = std::min(kFramesPerChunk, frames - first_frame);
+            if (file->seek(first_frame, SEEK_SET) != first_frame) {
+                seek_failed = true;
+                return;
+            }
+            ReadFrames(*file, sample_type, MutableFrame(first_frame), num_channels, count, cancel,
+                       [&](int64_t n) { publish(chunk, n); });
+        }
+    });
+
+    // Chunks after a short chunk are past the end of the data. Chunks whose seek failed are missing,
+    // and everything from the first of them is decoded again without seeking.
+    const int64_t loaded = loaded_frames.load(std::memory_order_acquire);
+    if (seek_failed && !cancel.Cancelled() && loaded < frames)
+        return LoadDecodedFrom(loaded, cancel);
+    return loaded;
+}
+
+int64_t AudioBuffer::LoadDecodedFrom(int64_t first_frame, const CancellationToken& cancel) {
+    SndfileHandle file(file_name);
+    if (!file)
+        return first_frame;
+    // Frames before |first_frame| are published and may be in use, so they are decoded to a
+    // scratch buffer and dropped rather than written again.
+    constexpr int64_t kFramesPerSkip = 1 << 16;
+    std::vector<uint8_t> scratch(kFramesPerSkip * num_channels * SampleSize());
+    for (int64_t skipped = 0; skipped < first_frame;) {
+        const int64_t n = ReadFrames(file, sample_type, scratch.data(), num_channels,
+                                     std::min(kFramesPerSkip, first_frame - skipped), cancel,
+                                     [](int64_t) {});
+        if (n <= 0)
+            return first_frame;
+        skipped += n;
+    }
+    return first_frame + ReadFrames(file, sample_type, MutableFrame(first_frame), num_channels,
+                                    num_frames - first_frame, cancel, [&](int64_t n) {
+                                        loaded_frames.store(first_frame + n,
+                                                            std::memory_order_release);
+                                    });
+}
 
-    samplerate = file.samplerate();
-    num_channels = file.channels();
-    format = file.format();
-    constexpr size_t kFramesPerRead = 10240;
-    size_t frames_read;
-    do {
-        // Make room for more samples.
-        samples.resize((num_frames + kFramesPerRead) * num_channels);
-
-        // Read frames to vector.
-        frames_read = file.readf(&samples[num_frames * num_channels], kFramesPerRead);
-        num_frames += frames_read;
-    } while (frames_read == kFramesPerRead);
-
-    // Trim end of vector.
-    samples.resize(num_frames * num_channels);
+std::unique_ptr<SndfileHandle> AudioBuffer::OpenDecoder() const {
+    return std::make_unique<SndfileHandle>(file_name);
 }
@@ -1,30 +1,116 @@
 #ifndef AUDIO_BUFFER_HPP
 #define AUDIO_BUFFER_HPP
 
-#include <assert.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstdint>
+#include <memory>
 #include <string>
-#include <vector>
+
+#include "mapped_file.hpp"
+#include "task_scheduler.hpp"
+
+class SndfileHandle;
+
+// Type of the samples in memory. 8 and 16-bit files are kept as 16-bit integers, everything else
+// as floats.
+enum SampleType { FLOAT32, INT16 };
+
+// Whether libsndfile seeks to exact frames in |file|, also in compressed data. Seeking in streams
+// such as Ogg and MP3 is not guaranteed to be exact.
+bool SeeksExactly(SndfileHandle& file);
 
 class AudioBuffer {
    public:
+    // Open the file and read its format. The samples are read by Load().
     AudioBuffer(std::string file_name);
+    virtual ~AudioBuffer();
+    // Read the samples, publishing them as they are read. Can be called on a worker thread while
+    // other threads use the loaded frames. Stops early if |cancel| is cancelled. Compressed files
+    // that can be seeked in are decoded in chunks by up to |max_decoders| workers at a time, or by
+    // all workers if 0.
+    void Load(const CancellationToken& cancel = {}, int max_decoders = 0);
     int Samplerate() const { return samplerate; }
     int NumChannels() const { return num_channels; }
-    int NumFrames() const { return num_frames; }
-    float Duration() const { return static_cast<float>(num_frames) / samplerate; }
-    const float* Samples() const { return samples.data(); }
-    const float* Samples(float start) const {
-        assert(start < Duration());
-        return samples.data() + num_channels * static_cast<int>(start * samplerate);
+    // Length of the file. Only changes when loading ends short of the length in the header.
+    int64_t NumFrames() const { return num_frames; }
+    // Frames from the start of the file that are loaded, growing during Load().
+    int64_t LoadedFrames() const { return loaded_frames.load(std::memory_order_acquire); }
+    bool Loaded() const { return loaded.load(std::memory_order_acquire); }
+    // Whether the length of the file is known and it can be seeked in exactly, so that it can be
+    // streamed from disk.
+    bool Streamable() const { return streamable; }
+    // Whether the samples are used in place from the memory-mapped file.
+    bool SamplesMapped() const { return sample_data && !samples; }
+    double Duration() const { return static_cast<double>(num_frames) / samplerate; }
+    SampleType Type() const { return sample_type; }
+    // Interleaved samples of Type().
+    const void* Data() const { return sample_data; }
+    // Call |function| with the interleaved samples as a pointer to their type, float or int16_t.
+    template <class F>
+    decltype(auto) VisitSamples(F function) const {
+        if (sample_type == INT16)
+            return function(static_cast<const int16_t*>(sample_data));
+        return function(static_cast<const float*>(sample_data));
+    }
+    // Convert |count| frames from |first_frame| to interleaved floats.
+    void ReadFloat(int64_t first_frame, int64_t count, float* dest) const;
+    // Memory of the loaded samples, not counting samples used in place from a mapped file.
+    size_t MemoryUsage() const {
+        return samples ? LoadedFrames() * num_channels * SampleSize() : 0;
     }
     operator bool() const { return samplerate != 0; }
+    const std::string& FileName() const { return file_name; }
+    // Canonical path, size and modification time of the file when it was loaded.
+    const std::string& FileIdentity() const { return file_identity; }
+
+   protected:
+    // Open another handle of the file for a parallel decoder. Virtual for tests.
+    virtual std::unique_ptr<SndfileHandle> OpenDecoder() const;
 
    private:
+    // Uncompressed WAV/RF64 files are memory-mapped instead of read through libsndfile.
+    bool OpenMapped(const std::string& file_name, int64_t frames);
+    void LoadMapped(const CancellationToken& cancel);
+    // Read a stream of unknown length to the end.
+    void ReadStream(SndfileHandle& file);
+    // Allocate the samples without touching them. Pages are zero until they are loaded.
+    void AllocateSamples(int64_t frames);
+    size_t SampleSize() const { return sample_type == INT16 ? sizeof(int16_t) : sizeof(float); }
+    void* MutableFrame(int64_t frame) {
+        return static_cast<uint8_t*>(samples.get()) + frame * num_channels * SampleSize();
+    }
+    void LoadDecoded(const CancellationToken& cancel, int max_decoders);
+    // Decode the chunks in parallel, each decoder with its own handle. Returns the number of frames
+    // decoded from the start of the file.
+    int64_t LoadDecodedChunks(const CancellationToken& cancel, int num_decoders);
+    // Decode from |first_frame| to the end with a new handle, reading from the start of the file
+    // without seeking. Returns the number of frames decoded from the start of the file.
+    int64_t LoadDecodedFrom(int64_t first_frame, const CancellationToken& cancel);
+
     int samplerate = 0;
     int num_channels = 0;
-    int num_frames = 0;
+    std::atomic<int64_t> num_frames{0};
+    std::atomic<int64_t> loaded_frames{0};
+    std::atomic<bool> loaded{false};
     int format = 0;
-    std::vector<float> samples;
+    bool streamable = false;
+    std::string file_identity;
+    struct FreeSamples {
+        void operator()(void* p) const { std::free(p); }
+    };
+
+    // Points either into |samples| or, for float and 16-bit files, directly into |mapped_file|.
+    SampleType sample_type = FLOAT32;
+    const void* sample_data = nullptr;
+    std::unique_ptr<void, FreeSamples> samples;
+    std::unique_ptr<MappedFile> mapped_file;
+    // Integer PCM in |mapped_file| that Load() converts to a full-length float copy.
+    size_t data_offset = 0;
+    int bytes_per_sample = 0;
+    std::string file_name;
+    // Compressed files are decoded by Load().
+    std::unique_ptr<SndfileHandle> decoded_file;
 };
 
 #endif
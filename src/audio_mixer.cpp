@@ -1,16 +1,159 @@
 #include "audio_mixer.hpp"
 
+#include <algorithm>
 #include <cassert>
 
+#include "cpu_features.hpp"
+
+#if defined(__SSE2__) || defined(HAVE_AVX2_KERNELS)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "sample_convert.hpp"
+
+namespace {
+// Frames of 16-bit input that are converted at a time.
+constexpr std::size_t kFramesPerConversion = 256;
+
+#if defined(HAVE_AVX2_KERNELS)
+struct Avx2Ops {
+    static constexpr int kWidth = 8;
+    AVX2_OPS static float Dot(const float* a, const float* b, int n) {
+        __m256 acc = _mm256_setzero_ps();
+        for (int i = 0; i < n; i += kWidth) {
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+        }
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+        return _mm_cvtss_f32(sum);
+    }
+};
+#endif
+
+#if defined(__SSE2__)
+struct Simd4Ops {
+    static constexpr int kWidth = 4;
+    static float Dot(const float* a, const float* b, int n) {
+        __m128 acc = _mm_setzero_ps();
+        for (int i = 0; i < n; i += kWidth) {
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        }
+        acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+        acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+        return _mm_cvtss_f32(acc);
+    }
+};
+#elif defined(__ARM_NEON)
+struct Simd4Ops {
+    static constexpr int kWidth = 4;
+    static float Dot(const float* a, const float* b, int n) {
+        float32x4_t acc = vdupq_n_f32(0.f);
+        for (int i = 0; i < n; i += kWidth) {
+            acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+        }
+        const float32x2_t sum = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+        return vget_lane_f32(vpadd_f32(sum, sum), 0);
+    }
+};
+#endif
+
+struct ScalarOps {
+    static constexpr int kWidth = 1;
+    static float Dot(const float* a, const float* b, int n) {
+        float sum = 0.f;
+        for (int i = 0; i < n; i++) {
+            sum += a[i] * b[i];
+        }
+        return sum;
+    }
+};
+
+// Layouts with few channels, with the matrix in locals and the loops unrolled by the compiler.
+template <int kInputs, int kOutputs>
+void MixFixed(const float* in, const float* matrix, float* out, std::size_t num_frames) {
+    float m[kOutputs * kInputs];
+    std::copy(matrix, matrix + kOutputs * kInputs, m);
+    for (std::size_t n = 0; n < num_frames; n++) {
+        for (int o = 0; o < kOutputs; o++) {
+            float sum = 0.f;
+            for (int i = 0; i < kInputs; i++) {
+                sum += in[i] * m[o * kInputs + i];
+            }
+            out[o] = sum;
+        }
+        in += kInputs;
+        out += kOutputs;
+    }
+}
+
+// One input channel of many to both output channels.
+void MixSolo(const float* in,
+             int num_inputs,
+             int channel,
+             const float* matrix,
+             float* out,
+             std::size_t num_frames) {
+    const float left = matrix[channel];
+    const float right = matrix[num_inputs + channel];
+    in += channel;
+    for (std::size_t n = 0; n < num_frames; n++) {
+        out[0] = *in * left;
+        out[1] = *in * right;
+        in += num_inputs;
+        out += 2;
+    }
+}
+
+// Any layout, as a dot product of each frame with each row of the matrix.
+template <class Ops>
+void MixGeneric(const float* in,
+                int num_inputs,
+                const float* matrix,
+                int num_outputs,
+                float* out,
+                std::size_t num_frames) {
+    const int num_vector_inputs = num_inputs - num_inputs % Ops::kWidth;
+    for (std::size_t n = 0; n < num_frames; n++) {
+        for (int o = 0; o < num_outputs; o++) {
+            const float* row = matrix + o * num_inputs;
+            float sum = Ops::Dot(row, in, num_vector_inputs);
+            for (int i = num_vector_inputs; i < num_inputs; i++) {
+                sum += row[i] * in[i];
+            }
+            out[o] = sum;
+        }
+        in += num_inputs;
+        out += num_outputs;
+    }
+}
+
+#if defined(HAVE_AVX2_KERNELS)
+AVX2_KERNEL void MixGenericAvx2(const float* in,
+                                int num_inputs,
+                                const float* matrix,
+                                int num_outputs,
+                                float* out,
+                                std::size_t num_frames) {
+    MixGeneric<Avx2Ops>(in, num_inputs, matrix, num_outputs, out, num_frames);
+}
+#endif
+}  // namespace
+
 AudioMixer::AudioMixer(int num_input_channels, int num_output_channels)
-    : mix_matrix_(num_output_channels, std::vector<float>(num_input_channels)),
+    : routing_(num_output_channels * num_input_channels),
+      matrix_(num_output_channels * num_input_channels),
+      converted_(kFramesPerConversion * num_input_channels),
       num_output_channels_(num_output_channels),
       num_input_channels_(num_input_channels) {
     if (num_input_channels > 1) {
         for (int m = 0; m < num_input_channels_; m++) {
             int output_chan = m % num_output_channels_;
-            mix_matrix_[output_chan][m] = 1.0f;
+            routing_[output_chan * num_input_channels_ + m] = 1.0f;
         }
+        UpdateMatrix();
     } else {
         Solo(0);
     }
@@ -18,27 +161,97 @@ AudioMixer::AudioMixer(int num_input_channels, int num_output_channels)
 
 void AudioMixer::Solo(int channel) {
     assert(channel >= 0 && channel < num_input_channels_);
+    std::fill(routing_.begin(), routing_.end(), 0.0f);
     for (int m = 0; m < num_output_channels_; ++m) {
-        std::fill(mix_matrix_[m].begin(), mix_matrix_[m].end(), 0.0f);
-        mix_matrix_[m][channel] = 1.0f;
+        routing_[m * num_input_channels_ + channel] = 1.0f;
     }
+    UpdateMatrix();
+}
+
+void AudioMixer::Route(int output_channel) {
+    assert(output_channel >= 0 && output_channel < num_output_channels_);
+    for (int m = 0; m < num_input_channels_; m++) {
+        float gain = 0.f;
+        for (int o = 0; o < num_output_channels_; o++) {
+            gain = std::max(gain, routing_[o * num_input_channels_ + m]);
+            routing_[o * num_input_channels_ + m] = 0.f;
+        }
+        routing_[output_channel * num_input_channels_ + m] = gain;
+    }
+    UpdateMatrix();
 }
 
 void AudioMixer::Gain(float linear_gain) {
     gain_ = linear_gain;
+    UpdateMatrix();
+}
+
+void AudioMixer::UpdateMatrix() {
+    for (std::size_t i = 0; i < routing_.size(); i++) {
+        matrix_[i] = routing_[i] * gain_;
+    }
+
+    layout_ = GENERIC;
+    if (num_output_channels_ != 2)
+        return;
+    if (num_input_channels_ == 1) {
+        layout_ = MONO_TO_STEREO;
+    } else if (num_input_channels_ == 2) {
+        layout_ = STEREO_TO_STEREO;
+    } else {
+        // A single input channel with any gain to each output channel.
+        int used = -1;
+        for (int m = 0; m < num_input_channels_; m++) {
+            if (routing_[m] == 0.f && routing_[num_input_channels_ + m] == 0.f)
+                continue;
+            if (used >= 0)
+                return;
+            used = m;
+        }
+        layout_ = SOLO_TO_STEREO;
+        solo_channel_ = std::max(used, 0);
+    }
 }
 
 void AudioMixer::Mix(const float* input_buffer, float* output_buffer, std::size_t num_frames) {
-    float* out = output_buffer;
-    float* in = const_cast<float*>(input_buffer);
-    for (std::size_t n = 0; n < num_frames; n++) {
-        for (int i = 0; i < num_output_channels_; i++) {
-            *out = 0.0;
-            for (int j = 0; j < num_input_channels_; j++) {
-                *out += *(in + j) * mix_matrix_[i][j] * gain_;
+    switch (layout_) {
+        case MONO_TO_STEREO:
+            MixFixed<1, 2>(input_buffer, matrix_.data(), output_buffer, num_frames);
+            break;
+        case STEREO_TO_STEREO:
+            MixFixed<2, 2>(input_buffer, matrix_.data(), output_buffer, num_frames);
+            break;
+        case SOLO_TO_STEREO:
+            MixSolo(input_buffer, num_input_channels_, solo_channel_, matrix_.data(),
+                    output_buffer, num_frames);
+            break;
+        case GENERIC:
+            // The widest SIMD that fits the input channels.
+#if defined(HAVE_AVX2_KERNELS)
+            if (kCpuHasAvx2 && num_input_channels_ >= Avx2Ops::kWidth) {
+                MixGenericAvx2(input_buffer, num_input_channels_, matrix_.data(),
+                               num_output_channels_, output_buffer, num_frames);
+                break;
             }
-            ++out;
-        }
-        in += num_input_channels_;
+#endif
+#if defined(__SSE2__) || defined(__ARM_NEON)
+            if (num_input_channels_ >= Simd4Ops::kWidth) {
+                MixGeneric<Simd4Ops>(input_buffer, num_input_channels_, matrix_.data(),
+                                     num_output_channels_, output_buffer, num_frames);
+                break;
+            }
+#endif
+            MixGeneric<ScalarOps>(input_buffer, num_input_channels_, matrix_.data(),
+                                  num_output_channels_, output_buffer, num_frames);
+            break;
+    }
+}
+
+void AudioMixer::Mix(const int16_t* input_buffer, float* output_buffer, std::size_t num_frames) {
+    for (std::size_t n = 0; n < num_frames; n += kFramesPerConversion) {
+        const std::size_t frames = std::min(kFramesPerConversion, num_frames - n);
+        Int16ToFloat(input_buffer + n * num_input_channels_, frames * num_input_channels_,
+                     converted_.data());
+        Mix(converted_.data(), output_buffer + n * num_output_channels_, frames);
     }
 }
@@ -1,21 +1,43 @@
 #ifndef AUDIO_MIXER_HPP
 #define AUDIO_MIXER_HPP
 
+#include <cstdint>
 #include <vector>
 
+// Mixes interleaved frames of the input channels to the output channels through a matrix. The
+// matrix is kept contiguous and scaled by the gain, and the kernel for its layout is chosen when
+// it changes: mono or stereo to stereo, a single soloed channel, or a SIMD dot product per output
+// channel for everything else.
 class AudioMixer {
    public:
     AudioMixer(int num_input_channels, int num_output_channels);
     ~AudioMixer() = default;
 
     void Mix(const float* input_buffer, float* output_buffer, std::size_t num_frames);
+    // Converts the input to floats a block at a time, without allocating.
+    void Mix(const int16_t* input_buffer, float* output_buffer, std::size_t num_frames);
     int NumOutputChannels() const { return num_output_channels_; }
     void Solo(int channel);
+    // Send every input channel only to |output_channel|, with its largest gain to any output
+    // channel. Applies to the current routing, e.g. after Solo().
+    void Route(int output_channel);
     void Gain(float linear_gain);
 
    private:
-    std::vector<std::vector<float>> mix_matrix_;
-    float gain_;
+    enum Layout { GENERIC, MONO_TO_STEREO, STEREO_TO_STEREO, SOLO_TO_STEREO };
+
+    // Scale the routing by the gain and pick the kernel.
+    void UpdateMatrix();
+
+    // Gain from each input channel to each output channel, one row per output channel.
+    std::vector<float> routing_;
+    // Routing times gain.
+    std::vector<float> matrix_;
+    std::vector<float> converted_;
+    float gain_ = 1.f;
+    Layout layout_ = GENERIC;
+    // Input channel of SOLO_TO_STEREO.
+    int solo_channel_ = 0;
     int num_output_channels_;
     int num_input_channels_;
 };
@@ -0,0 +1,217 @@
+#include "audio_stream.hpp"
+
+#include <sndfile.hh>
+#include <algorithm>
+#include <chrono>
+
+#include "audio_buffer.hpp"
+
+namespace {
+// How often the reader checks whether a playhead has moved, while there are streams. Far shorter
+// than the blocks read ahead of playback.
+constexpr auto kPollInterval = std::chrono::milliseconds(10);
+}  // namespace
+
+AudioStream::AudioStream(std::string file_name,
+                         int num_channels,
+                         int64_t loop_start,
+                         int64_t first_frame)
+    : file_name(std::move(file_name)),
+      num_channels(num_channels),
+      loop_start(loop_start),
+      blocks(kNumBlocks),
+      playhead(first_frame) {}
+
+AudioStream::~AudioStream() = default;
+
+void AudioStream::Open() {
+    auto handle = std::make_unique<SndfileHandle>(file_name);
+    // The file may have changed since it was loaded.
+    if (*handle && handle->channels() == num_channels && handle->frames() > 0 &&
+        handle->frames() != SF_COUNT_MAX && SeeksExactly(*handle)) {
+        num_frames = handle->frames();
+        for (Block& block : blocks) {
+            block.samples.resize(kFramesPerBlock * num_channels);
+        }
+        file = std::move(handle);
+        // Playback waits for the first blocks, so that it does not start with silence.
+        ReadNext();
+        ReadNext();
+    }
+    ready.store(true, std::memory_order_release);
+}
+
+bool AudioStream::ReadNext() {
+    if (!file)
+        return false;
+    const int64_t num_file_blocks = (num_frames + kFramesPerBlock - 1) / kFramesPerBlock;
+    const int64_t current =
+        std::max<int64_t>(playhead.load(std::memory_order_relaxed), 0) / kFramesPerBlock;
+    const int64_t loop = std::max<int64_t>(loop_start, 0) / kFramesPerBlock;
+
+    // The next two blocks, the two that playback loops back to, and then further ahead. One block
+    // is left for the audio thread to hold on to.
+    std::vector<int64_t> wanted;
+    auto want = [&](int64_t number) {
+        if (number < num_file_blocks && wanted.size() < kNumBlocks - 1 &&
+            std::find(wanted.begin(), wanted.end(), number) == wanted.end()) {
+            wanted.push_back(number);
+        }
+    };
+    want(current);
+    want(current + 1);
+    want(loop);
+    want(loop + 1);
+    for (int64_t number = current + 2; number < current + kNumBlocks; number++) {
+        want(number);
+    }
+
+    for (const int64_t number : wanted) {
+        if (std::any_of(blocks.begin(), blocks.end(), [&](const Block& block) {
+                return block.number.load(std::memory_order_relaxed) == number;
+            })) {
+            continue;
+        }
+        // Replace an empty block or one that is no longer wanted, unless it is being copied.
+        for (int i = 0; i < kNumBlocks; i++) {
+            Block& block = blocks[i];
+            const int64_t previous = block.number.load(std::memory_order_relaxed);
+            if (previous >= 0 &&
+                std::find(wanted.begin(), wanted.end(), previous) != wanted.end()) {
+                continue;
+            }
+            block.number.store(-1, std::memory_order_seq_cst);
+            if (reading.load(std::memory_order_seq_cst) == i) {
+                block.number.store(previous, std::memory_order_release);
+                continue;
+            }
+            const int64_t first_frame = number * kFramesPerBlock;
+            const int64_t count = std::min(kFramesPerBlock, num_frames - first_frame);
+            sf_count_t frames_read = 0;
+            if (file->seek(first_frame, SEEK_SET) == first_frame) {
+                frames_read = std::max<sf_count_t>(file->readf(block.samples.data(), count), 0);
+            }
+            std::fill(block.samples.begin() + frames_read * num_channels, block.samples.end(),
+                      0.f);
+            block.number.store(number, std::memory_order_release);
+            return true;
+        }
+        return false;
+    }
+    return false;
+}
+
+bool AudioStream::Read(int64_t first_frame, int64_t count, float* dest) {
+    playhead.store(first_frame, std::memory_order_relaxed);
+    // The block that playback has moved on from can be replaced.
+    const int64_t block = std::max<int64_t>(first_frame, 0) / kFramesPerBlock;
+    if (block != playhead_block) {
+        playhead_block = block;
+        reader->WakeUp();
+    }
+    bool complete = true;
+    int64_t done = 0;
+    while (done < count) {
+        const int64_t frame = first_frame + done;
+        float* d = dest + done * num_channels;
+        if (frame < 0 || frame >= num_frames) {
+            const int64_t n = frame < 0 ? std::min(count - done, -frame) : count - done;
+            std::fill(d, d + n * num_channels, 0.f);
+            done += n;
+            continue;
+        }
+        const int64_t offset = frame % kFramesPerBlock;
+        const int64_t n = std::min({count - done, kFramesPerBlock - offset, num_frames - frame});
+        if (!Copy(frame / kFramesPerBlock, offset, n, d)) {
+            std::fill(d, d + n * num_channels, 0.f);
+            complete = false;
+        }
+        done += n;
+    }
+    return complete;
+}
+
+bool AudioStream::Copy(int64_t number, int64_t offset, int64_t count, float* dest) {
+    for (int i = 0; i < kNumBlocks; i++) {
+        Block& block = blocks[i];
+        if (block.number.load(std::memory_order_relaxed) != number)
+            continue;
+        // Announce the copy before checking the block again. Either the reader sees it and leaves
+        // the block alone, or this thread sees that the block is being replaced.
+        reading.store(i, std::memory_order_seq_cst);
+        const bool valid = block.number.load(std::memory_order_seq_cst) == number;
+        if (valid) {
+            const float* src = &block.samples[offset * num_channels];
+            std::copy(src, src + count * num_channels, dest);
+        }
+        reading.store(-1, std::memory_order_release);
+        return valid;
+    }
+    return false;
+}
+
+AudioStreamReader::AudioStreamReader() : thread([this] { Run(); }) {}
+
+AudioStreamReader::~AudioStreamReader() {
+    {
+        std::scoped_lock lock(mutex);
+        quit = true;
+    }
+    condition.notify_one();
+    thread.join();
+}
+
+void AudioStreamReader::Add(std::shared_ptr<AudioStream> stream) {
+    stream->reader = this;
+    {
+        std::scoped_lock lock(mutex);
+        streams.push_back(std::move(stream));
+        woken.store(true, std::memory_order_relaxed);
+    }
+    condition.notify_one();
+}
+
+void AudioStreamReader::WakeUp() {
+    woken.store(true, std::memory_order_release);
+}
+
+void AudioStreamReader::Run() {
+    std::unique_lock lock(mutex);
+    while (!quit) {
+        // Streams that only the reader holds on to are no longer played. They are closed without
+        // the lock held.
+        std::vector<std::shared_ptr<AudioStream>> active;
+        std::vector<std::shared_ptr<AudioStream>> unused;
+        for (std::shared_ptr<AudioStream>& stream : streams) {
+            (stream.use_count() == 1 ? unused : active).push_back(std::move(stream));
+        }
+        streams = active;
+        lock.unlock();
+        unused.clear();
+
+        // New streams are opened first, and then every stream reads a block in turn.
+        woken.store(false, std::memory_order_relaxed);
+        bool busy = false;
+        for (const std::shared_ptr<AudioStream>& stream : active) {
+            if (!stream->Ready()) {
+                stream->Open();
+                busy = true;
+            }
+        }
+        for (const std::shared_ptr<AudioStream>& stream : active) {
+            busy = stream->ReadNext() || busy;
+        }
+        active.clear();
+
+        lock.lock();
+        if (busy)
+            continue;
+        if (streams.empty()) {
+            condition.wait(lock, [this] { return quit || !streams.empty(); });
+        } else {
+            while (!quit && !woken.load(std::memory_order_acquire)) {
+                condition.wait_for(lock, kPollInterval);
+            }
+        }
+    }
+}
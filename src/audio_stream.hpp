@@ -0,0 +1,95 @@
+#ifndef AUDIO_STREAM_HPP
+#define AUDIO_STREAM_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class AudioStreamReader;
+class SndfileHandle;
+
+// Frames of a file read from disk ahead of playback, for files that are not in memory. The reader
+// keeps blocks of frames around the playhead and where playback loops back to in a fixed set of
+// buffers. The audio thread copies from them without locking, and a block that is not read yet
+// plays as silence. The audio thread announces the block it copies from, and the reader never
+// replaces that block.
+class AudioStream {
+   public:
+    static constexpr int64_t kFramesPerBlock = 8192;
+    static constexpr int kNumBlocks = 16;
+
+    // Stream of a file with |num_channels| that plays from |first_frame| and loops back to
+    // |loop_start|. Nothing is read until the stream is added to an AudioStreamReader.
+    AudioStream(std::string file_name, int num_channels, int64_t loop_start, int64_t first_frame);
+    ~AudioStream();
+    // Whether the reader has opened the file and read the first blocks, or failed to open it, in
+    // which case the stream is silent.
+    bool Ready() const { return ready.load(std::memory_order_acquire); }
+    // Copy |count| frames from |first_frame| as interleaved floats to |dest|, from the audio thread.
+    // Frames outside of the file or not read yet are zero. Returns false if frames were not read.
+    bool Read(int64_t first_frame, int64_t count, float* dest);
+
+   private:
+    friend class AudioStreamReader;
+
+    struct Block {
+        // Block of the file in |samples|, or -1 while empty or being filled.
+        std::atomic<int64_t> number{-1};
+        std::vector<float> samples;
+    };
+
+    // Open the file and read the blocks that playback starts with, on the reader thread.
+    void Open();
+    // Read the most urgent block that is missing, on the reader thread. Returns false if there is
+    // none.
+    bool ReadNext();
+    // Copy |count| frames from |offset| of block |number| if it is read.
+    bool Copy(int64_t number, int64_t offset, int64_t count, float* dest);
+
+    const std::string file_name;
+    const int num_channels;
+    const int64_t loop_start;
+    // Set when the stream is added to a reader.
+    AudioStreamReader* reader = nullptr;
+    // Only used by the reader thread once it has opened the file.
+    std::unique_ptr<SndfileHandle> file;
+    int64_t num_frames = 0;
+    std::vector<Block> blocks;
+    std::atomic<bool> ready{false};
+    // Block that the audio thread copies from, or -1.
+    std::atomic<int> reading{-1};
+    std::atomic<int64_t> playhead;
+    // Block of the playhead at the last Read(), only used by the audio thread.
+    int64_t playhead_block = -1;
+};
+
+// A thread that opens and reads the files of all streams, so that neither the UI thread nor the
+// audio thread waits for the disk. It sleeps until a stream is added, and while there are streams
+// it polls whether the playhead of one has moved to another block.
+class AudioStreamReader {
+   public:
+    AudioStreamReader();
+    ~AudioStreamReader();
+    // Read |stream| for as long as it is used elsewhere.
+    void Add(std::shared_ptr<AudioStream> stream);
+    // Called by the audio thread when a playhead moves to another block. Only sets a flag that the
+    // reader polls, since waking up a thread can make a system call.
+    void WakeUp();
+
+   private:
+    void Run();
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::vector<std::shared_ptr<AudioStream>> streams;
+    std::atomic<bool> woken{false};
+    bool quit = false;
+    std::thread thread;
+};
+
+#endif
@@ -1,5 +1,6 @@
 #include "audio_system.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <cstring>
@@ -7,6 +8,7 @@
 #include <memory>
 
 #include "portaudio.h"
+#include "sample_convert.hpp"
 
 AudioSystem::AudioSystem() {
     Pa_Initialize();
@@ -15,7 +17,7 @@ AudioSystem::AudioSystem() {
 
 AudioSystem::~AudioSystem() {
     if (stream) {
-        Pa_CloseStream(stream);
+        CloseStream();
     }
     Pa_Terminate();
 }
@@ -24,18 +26,12 @@ int AudioSystem::NumOutputChannels() {
     return 2;
 }
 
-void AudioSystem::SetLooping(bool do_loop) {
-    loop = do_loop;
-}
-
-void AudioSystem::TogglePlayback(std::shared_ptr<AudioBuffer> ab,
-                                 std::unique_ptr<AudioMixer> mixer,
-                                 float start,
-                                 std::optional<float> end) {
-    if (stream && Pa_IsStreamActive(stream)) {
-        Pa_AbortStream(stream);
+void AudioSystem::TogglePlayback(Input input, double start, std::optional<double> end) {
+    double time;
+    if (Playing(&time)) {
+        Stop();
     } else {
-        Play(ab, std::move(mixer), start, end);
+        Play(std::move(input), start, end);
     }
 }
 
@@ -48,19 +44,66 @@ double AudioSystem::OutputLatencyMs() {
     return stream_info->outputLatency * 1000.0;
 }
 
-void AudioSystem::Play(std::shared_ptr<AudioBuffer> ab,
-                       std::unique_ptr<AudioMixer> mixer,
-                       float start,
-                       std::optional<float> end) {
-    mixer_ = std::move(mixer);
-    assert(mixer_->NumOutputChannels() == NumOutputChannels());
-    if (stream && samplerate != ab->Samplerate()) {
-        Pa_CloseStream(stream);
-        stream = nullptr;
-    } else if (stream) {
-        Pa_AbortStream(stream);
+void AudioSystem::Play(Input input, double start, std::optional<double> end) {
+    std::vector<Input> inputs;
+    inputs.push_back(std::move(input));
+    PlayMix(std::move(inputs), start, end);
+}
+
+void AudioSystem::PlayMix(std::vector<Input> inputs, double start, std::optional<double> end) {
+    if (!OpenStream())
+        return;
+    if (end && start > *end) {
+        std::swap(start, *end);
+    }
+    std::unique_ptr<Playback> playback = NewPlayback(std::move(inputs), start, end);
+    if (!playback) {
+        Stop();
+        return;
+    }
+    Send({playback.release()});
+}
+
+bool AudioSystem::Switch(Input input) {
+    double time;
+    if (!Playing(&time))
+        return false;
+    if (current->sources.size() == 1 && current->sources[0].id == input.id)
+        return true;
+    std::vector<Input> inputs;
+    inputs.push_back(std::move(input));
+    std::unique_ptr<Playback> playback =
+        NewPlayback(std::move(inputs), static_cast<double>(current->start_frame) / samplerate,
+                    static_cast<double>(current->end_frame) / samplerate, time);
+    if (!playback)
+        return false;
+    Send({playback.release(), true});
+    return true;
+}
+
+void AudioSystem::SetGain(int id, float gain) {
+    if (!current)
+        return;
+    for (Source& s : current->sources) {
+        if (s.id == id) {
+            s.gain.store(gain, std::memory_order_relaxed);
+        }
     }
+}
+
+bool AudioSystem::UsesSamples(const AudioBuffer* buffer) const {
+    if (!current)
+        return false;
+    return std::any_of(current->sources.begin(), current->sources.end(),
+                       [&](const Source& s) { return s.buffer.get() == buffer; });
+}
+
+bool AudioSystem::OpenStream() {
+    if (stream)
+        return true;
 
+    // The stream runs at the native rate of the device and keeps running between playbacks, so
+    // that starting one is only a command.
     const PaDeviceInfo* output_device_info = Pa_GetDeviceInfo(output_device_);
     PaStreamParameters output_stream_parameter = {
         .device = output_device_,
@@ -69,39 +112,133 @@ void AudioSystem::Play(std::shared_ptr<AudioBuffer> ab,
         .suggestedLatency = output_device_info->defaultHighOutputLatency,
         .hostApiSpecificStreamInfo = nullptr,
     };
+    num_channels = NumOutputChannels();
+    samplerate = static_cast<int>(output_device_info->defaultSampleRate);
+    crossfade_frames = std::max(samplerate * kCrossfadeMs / 1000, 1);
+    fade_buffer.resize(kFramesPerChunk * num_channels);
+    source_buffer.resize(kFramesPerChunk * num_channels);
+    PaError err = Pa_OpenStream(&stream, nullptr, &output_stream_parameter, samplerate,
+                                paFramesPerBufferUnspecified, paNoFlag, Callback, this);
+    if (err != paNoError) {
+        std::cerr << "An error occured while opening audio stream: " << Pa_GetErrorText(err)
+                  << " (" << err << ")" << std::endl;
+        stream = nullptr;
+        return false;
+    }
+    Pa_StartStream(stream);
+    return true;
+}
 
-    if (!stream) {
-        num_channels = NumOutputChannels();
-        samplerate = ab->Samplerate();
-        PaError err = Pa_OpenStream(&stream, nullptr, &output_stream_parameter, samplerate,
-                                    paFramesPerBufferUnspecified, paNoFlag, Callback, this);
-        if (err != paNoError) {
-            std::cerr << "An error occured while opening audio stream: " << Pa_GetErrorText(err)
-                      << " (" << err << ")" << std::endl;
-            return;
+std::unique_ptr<AudioSystem::Playback> AudioSystem::NewPlayback(std::vector<Input> inputs,
+                                                                double start,
+                                                                std::optional<double> end,
+                                                                std::optional<double> from) {
+    // The mix ends with the input that ends last, unless an end is given.
+    double end_time = 0.0;
+    for (const Input& input : inputs) {
+        end_time = std::max(end_time, input.offset + input.duration);
+    }
+    if (end) {
+        end_time = std::min(end_time, *end);
+    }
+    auto playback = std::make_unique<Playback>(inputs.size());
+    playback->start_frame = std::max<int64_t>(std::floor(start * samplerate), 0);
+    playback->end_frame = std::ceil(end_time * samplerate);
+    if (playback->end_frame <= playback->start_frame) {
+        return nullptr;
+    }
+    playback->frame = playback->start_frame;
+    playback->position = playback->start_frame;
+    const int64_t first_frame =
+        from ? std::clamp<int64_t>(std::llround(*from * samplerate), playback->start_frame,
+                                   playback->end_frame - 1)
+             : playback->start_frame;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        Input& input = inputs[i];
+        Source& s = playback->sources[i];
+        assert(input.mixer->NumOutputChannels() == num_channels);
+        s.id = input.id;
+        s.samplerate = input.samplerate;
+        int64_t max_input_frames = kFramesPerChunk;
+        if (s.samplerate != samplerate) {
+            s.resampler = std::make_unique<Resampler>(num_channels, s.samplerate, samplerate,
+                                                      kFramesPerChunk);
+            max_input_frames = s.resampler->MaxInputFrames();
+            s.mixed.resize(max_input_frames * num_channels);
+        }
+        // Files are played from disk whenever they can be seeked in exactly, also where their
+        // samples are in memory or mapped from the file, so that the callback never touches pages
+        // that may have to be read from disk or waits for a load. The file is opened by the reader.
+        const bool streamed = !input.buffer || input.buffer->Streamable();
+        if (!streamed) {
+            s.buffer = std::move(input.buffer);
+        }
+        s.mixer = std::move(input.mixer);
+        s.offset = input.offset;
+        s.gain = input.gain;
+        if (streamed) {
+            Seek(s, first_frame);
+            const int64_t stream_frame = s.index;
+            Seek(s, playback->start_frame);
+            s.stream = std::make_shared<AudioStream>(input.file_name, input.num_channels, s.index,
+                                                     stream_frame);
+            s.streamed.resize(max_input_frames * input.num_channels);
+            reader.Add(s.stream);
+        } else {
+            Seek(s, playback->start_frame);
         }
     }
-    playingBuffer = ab;
-    if (end && start > *end) {
-        std::swap(start, *end);
+    return playback;
+}
+
+void AudioSystem::Stop() {
+    if (current) {
+        Send({nullptr});
     }
-    start_index = std::floor(start * ab->Samplerate());
-    start_index = std::max(start_index, 0);
-    start_index = std::min(start_index, ab->NumFrames());
-    end_index = end ? std::floor(*end * ab->Samplerate()) : ab->NumFrames();
-    end_index = std::min(end_index, ab->NumFrames());
-    index = start_index;
-    if (end_index != start_index) {
-        Pa_StartStream(stream);
+}
+
+bool AudioSystem::Playing(double* time) {
+    FreeRetired();
+    if (!current || current->done.load(std::memory_order_acquire))
+        return false;
+    *time = static_cast<double>(current->position.load(std::memory_order_relaxed)) / samplerate;
+    return true;
+}
+
+void AudioSystem::Send(Command command) {
+    FreeRetired();
+    if (!stream || !commands.Push(command)) {
+        delete command.playback;
+        return;
     }
+    current = command.playback;
 }
 
-bool AudioSystem::Playing(float* time) {
-    if (stream && Pa_IsStreamActive(stream)) {
-        *time = static_cast<float>(index) / playingBuffer->Samplerate();
-        return true;
+void AudioSystem::FreeRetired() {
+    Playback* playback;
+    while (retired.Pop(&playback)) {
+        delete playback;
+    }
+}
+
+void AudioSystem::CloseStream() {
+    Pa_CloseStream(stream);
+    stream = nullptr;
+    // The callback no longer runs, so this thread takes over its end of the queues.
+    Command command;
+    while (commands.Pop(&command)) {
+        delete command.playback;
+    }
+    if (pending) {
+        delete pending->playback;
+        pending.reset();
     }
-    return false;
+    delete active;
+    active = nullptr;
+    delete fading;
+    fading = nullptr;
+    current = nullptr;
+    FreeRetired();
 }
 
 int AudioSystem::Callback(const void* input_buffer,
@@ -112,25 +249,165 @@ int AudioSystem::Callback(const void* input_buffer,
                           void* user_data) {
     float* out = static_cast<float*>(output_buffer);
     AudioSystem* t = static_cast<AudioSystem*>(user_data);
-    const int frames = static_cast<int>(frames_per_buffer);
-    const int frames_to_copy = std::min(frames, t->end_index - t->index);
-    const float* samples = t->playingBuffer->Samples();
-
-    t->mixer_->Mix(&samples[t->playingBuffer->NumChannels() * t->index], out, frames_to_copy);
-    t->index += frames_to_copy;
-    if (frames_to_copy < frames) {
-        if (t->loop) {
-            t->index = t->start_index;
-            // Call the callback recursively.
-            return Callback(input_buffer, &out[t->num_channels * frames_to_copy],
-                            frames_per_buffer - frames_to_copy, time_info, status_flags, user_data);
-        } else {
-            for (int i = frames_to_copy * t->num_channels; i < frames * t->num_channels; i++) {
-                out[i] = 0.f;
-            }
-            return paComplete;
+    const int64_t frames = static_cast<int64_t>(frames_per_buffer);
+
+    // Only the latest command matters, and replaced playbacks are returned to the UI thread. A
+    // playback that streams starts once its first blocks are read, and the active one plays on
+    // until then.
+    Command command;
+    while (t->commands.Pop(&command)) {
+        if (t->pending && t->pending->playback) {
+            t->retired.Push(t->pending->playback);
         }
+        t->pending = command;
     }
+    if (t->pending && (!t->pending->playback || t->pending->playback->Ready())) {
+        t->Start(*t->pending);
+        t->pending.reset();
+    }
+
+    int64_t written = 0;
+    if (t->active) {
+        written = t->Produce(t->active, out, frames);
+    }
+    // Silence until the next playback.
+    std::fill(&out[t->num_channels * written], &out[t->num_channels * frames], 0.f);
 
+    // The buffers are time aligned and usually similar, so linear gains that sum to one keep the
+    // level constant through the crossfade.
+    int64_t faded = 0;
+    while (t->fading && faded < frames) {
+        const int64_t n = std::min<int64_t>(
+            {frames - faded, kFramesPerChunk, t->crossfade_frames - t->fade_index});
+        const int64_t produced = t->Produce(t->fading, t->fade_buffer.data(), n);
+        std::fill(&t->fade_buffer[t->num_channels * produced],
+                  &t->fade_buffer[t->num_channels * n], 0.f);
+        for (int64_t i = 0; i < n; i++) {
+            const float gain =
+                static_cast<float>(t->fade_index + i + 1) / (t->crossfade_frames + 1);
+            float* o = &out[t->num_channels * (faded + i)];
+            const float* f = &t->fade_buffer[t->num_channels * i];
+            for (int c = 0; c < t->num_channels; c++) {
+                o[c] = gain * o[c] + (1.f - gain) * f[c];
+            }
+        }
+        faded += n;
+        t->fade_index += n;
+        if (t->fade_index == t->crossfade_frames) {
+            t->retired.Push(t->fading);
+            t->fading = nullptr;
+        }
+    }
     return paContinue;
 }
+
+bool AudioSystem::Playback::Ready() const {
+    return std::all_of(sources.begin(), sources.end(),
+                       [](const Source& s) { return !s.stream || s.stream->Ready(); });
+}
+
+void AudioSystem::Start(Command command) {
+    // Replaced playbacks are returned to the UI thread, unless one is faded out first.
+    Playback* previous = active;
+    if (command.crossfade && command.playback && previous) {
+        Playback* p = command.playback;
+        p->frame = std::clamp(previous->frame, p->start_frame, p->end_frame);
+        for (Source& s : p->sources) {
+            Seek(s, p->frame);
+        }
+        p->position.store(p->frame, std::memory_order_relaxed);
+    }
+    if (fading) {
+        retired.Push(fading);
+        fading = nullptr;
+    }
+    if (command.crossfade && previous && !previous->done.load(std::memory_order_relaxed)) {
+        fading = previous;
+        fade_index = 0;
+    } else if (previous) {
+        retired.Push(previous);
+    }
+    active = command.playback;
+}
+
+int64_t AudioSystem::Produce(Playback* p, float* dest, int64_t frames) {
+    int64_t written = 0;
+    while (written < frames && !p->done.load(std::memory_order_relaxed)) {
+        const int n =
+            std::min<int64_t>({frames - written, kFramesPerChunk, p->end_frame - p->frame});
+        float* chunk = &dest[num_channels * written];
+        std::fill(chunk, chunk + num_channels * n, 0.f);
+        for (Source& s : p->sources) {
+            Render(s, source_buffer.data(), n);
+            AddScaled(source_buffer.data(), s.gain.load(std::memory_order_relaxed),
+                      num_channels * n, chunk);
+        }
+        p->frame += n;
+        written += n;
+        if (p->frame == p->end_frame) {
+            if (!loop.load(std::memory_order_relaxed)) {
+                p->done.store(true, std::memory_order_release);
+                break;
+            }
+            p->frame = p->start_frame;
+            for (Source& s : p->sources) {
+                Seek(s, p->frame);
+            }
+        }
+    }
+    p->position.store(p->frame, std::memory_order_relaxed);
+    return written;
+}
+
+void AudioSystem::Render(Source& s, float* dest, int frames) {
+    if (!s.resampler) {
+        Read(s, dest, frames);
+        return;
+    }
+    const int64_t input_frames = s.resampler->InputFramesNeeded(frames);
+    Read(s, s.mixed.data(), input_frames);
+    s.resampler->Process(s.mixed.data(), dest, frames);
+}
+
+void AudioSystem::Read(Source& s, float* dest, int64_t frames) {
+    if (s.stream) {
+        s.stream->Read(s.index, frames, s.streamed.data());
+        s.mixer->Mix(s.streamed.data(), dest, frames);
+        s.index += frames;
+        return;
+    }
+
+    if (!s.buffer) {
+        std::fill(dest, &dest[num_channels * frames], 0.f);
+        s.index += frames;
+        return;
+    }
+
+    // Silence before the buffer and after what is loaded, whose memory may not even be touched
+    // yet, so that the callback does not take a page fault for it.
+    const int64_t before = std::clamp<int64_t>(-s.index, 0, frames);
+    const int64_t inside =
+        std::clamp<int64_t>(s.buffer->LoadedFrames() - s.index - before, 0, frames - before);
+    std::fill(dest, &dest[num_channels * before], 0.f);
+    if (inside) {
+        s.buffer->VisitSamples([&](const auto* samples) {
+            s.mixer->Mix(samples + s.buffer->NumChannels() * (s.index + before),
+                         &dest[num_channels * before], inside);
+        });
+    }
+    std::fill(&dest[num_channels * (before + inside)], &dest[num_channels * frames], 0.f);
+    s.index += frames;
+}
+
+void AudioSystem::Seek(Source& s, int64_t frame) const {
+    const double index =
+        (static_cast<double>(frame) / samplerate - s.offset) * s.samplerate;
+    if (!s.resampler) {
+        s.index = std::llround(index);
+        return;
+    }
+    // The resampler starts between input frames.
+    s.index = std::floor(index);
+    s.resampler->Reset();
+    s.resampler->SetOffset(index - s.index);
+}
@@ -1,54 +1,172 @@
 #ifndef AUDIO_SYSTEM_HPP
 #define AUDIO_SYSTEM_HPP
 
+#include <atomic>
+#include <cstdint>
 #include <memory>
 #include <optional>
+#include <string>
+#include <vector>
 
 #include <portaudio.h>
 
 #include "audio_buffer.hpp"
 #include "audio_mixer.hpp"
+#include "audio_stream.hpp"
+#include "resampler.hpp"
+#include "spsc_queue.hpp"
 
+// Playback through PortAudio. The UI thread sends commands to the callback through a lock-free
+// queue, and the callback reports the position through atomics. The callback never locks or makes
+// system calls, and what it stops playing is handed back to the UI thread to be freed. One stream is kept open at
+// the native rate of the device, and buffers with other rates are resampled. A playback is the
+// sum of any number of buffers, and can switch between time-aligned buffers with a short
+// crossfade, for A/B comparisons. Files are streamed by a reader thread unless they cannot be
+// seeked in exactly, and a playback starts once the first blocks of its streams are read.
 class AudioSystem {
    public:
+    // A track of a playback. Its samples are streamed from |file_name|, and only read from
+    // |buffer| if the file cannot be streamed. |buffer| may be null, e.g. when the track was
+    // evicted from memory.
+    // The mixer routes its channels to the output channels, and the track starts |offset| seconds
+    // into the mix.
+    struct Input {
+        // Identifies the input in SetGain() and Switch(), e.g. by the track it was made from.
+        int id = 0;
+        std::shared_ptr<AudioBuffer> buffer;
+        std::string file_name;
+        int num_channels = 0;
+        int samplerate = 0;
+        double duration = 0.0;
+        std::unique_ptr<AudioMixer> mixer;
+        double offset = 0.0;
+        float gain = 1.f;
+    };
+
     AudioSystem();
     ~AudioSystem();
-    void TogglePlayback(std::shared_ptr<AudioBuffer> ab,
-                        std::unique_ptr<AudioMixer> mixer,
-                        float start,
-                        std::optional<float> end);
-    void Play(std::shared_ptr<AudioBuffer> ab,
-              std::unique_ptr<AudioMixer> mixer,
-              float start,
-              std::optional<float> end);
-    bool Playing(float* time);
-    void SetLooping(bool do_loop);
+    void TogglePlayback(Input input, double start, std::optional<double> end);
+    void Play(Input input, double start, std::optional<double> end);
+    // Play the sum of |inputs| from |start| seconds into the mix to |end|, or to the end of the
+    // last input.
+    void PlayMix(std::vector<Input> inputs, double start, std::optional<double> end);
+    // Continue the current playback with |input| from the same position and within the same
+    // range, crossfading from the previous inputs. Returns false if nothing is playing.
+    bool Switch(Input input);
+    // Change the gain of the input with |id| in the current playback while it plays, e.g. to mute
+    // it.
+    void SetGain(int id, float gain);
+    void Stop();
+    bool Playing(double* time);
+    void SetLooping(bool do_loop) { loop = do_loop; }
     bool Looping() const { return loop; }
+    // Whether the last playback that was started reads the samples of |buffer| in memory, which
+    // must then stay loaded, i.e. the file cannot be streamed.
+    bool UsesSamples(const AudioBuffer* buffer) const;
 
     // Playout latency as reported by the soundcard.
     double OutputLatencyMs();
 
     int NumOutputChannels();
 
-    std::shared_ptr<AudioBuffer> playingBuffer;
-
-    int index;
-    int end_index;
-
    private:
+    // An input of a playback. |index| is the next frame to read, and may be before or after the
+    // file where it is silent.
+    struct Source {
+        int id = 0;
+        int samplerate = 0;
+        // The samples are read either from |buffer| in memory or from |stream|, through |streamed|.
+        // A file that can be neither is silent.
+        std::shared_ptr<AudioBuffer> buffer;
+        std::shared_ptr<AudioStream> stream;
+        std::vector<float> streamed;
+        std::unique_ptr<AudioMixer> mixer;
+        // Converts to the rate of the stream, or nullptr if the rates are the same. The input is
+        // mixed into |mixed| first.
+        std::unique_ptr<Resampler> resampler;
+        std::vector<float> mixed;
+        double offset = 0.0;
+        int64_t index = 0;
+        std::atomic<float> gain{1.f};
+    };
+    // Frames from |start_frame| to |end_frame| of the sum of |sources|, at the rate of the stream.
+    // Once sent, only the callback writes |frame|, |position|, |done| and the indices of the
+    // sources.
+    struct Playback {
+        explicit Playback(size_t num_sources) : sources(num_sources) {}
+        // Whether the streams of all sources can be read.
+        bool Ready() const;
+        std::vector<Source> sources;
+        int64_t start_frame = 0;
+        int64_t end_frame = 0;
+        int64_t frame = 0;
+        std::atomic<int64_t> position{0};
+        std::atomic<bool> done{false};
+    };
+    // Starts |playback|, or stops if nullptr. With |crossfade|, |playback| continues from the
+    // position of the previous playback.
+    struct Command {
+        Playback* playback = nullptr;
+        bool crossfade = false;
+    };
+    static constexpr size_t kQueueSize = 64;
+    // Frames mixed, resampled or crossfaded at a time.
+    static constexpr int kFramesPerChunk = 512;
+    static constexpr int kCrossfadeMs = 10;
+
     static int Callback(const void* input_buffer,
                         void* output_buffer,
                         unsigned long frames_per_buffer,
                         const PaStreamCallbackTimeInfo* time_info,
                         PaStreamCallbackFlags status_flags,
                         void* user_data);
+    // Start the playback of |command| in the callback.
+    void Start(Command command);
+    // Write up to |frames| frames of |p| to |dest|, from the callback. Wraps around when looping.
+    // Returns the number of frames written, which is less at the end.
+    int64_t Produce(Playback* p, float* dest, int64_t frames);
+    // Write |frames| frames of |s| at the rate of the stream to |dest|.
+    void Render(Source& s, float* dest, int frames);
+    // Mix |frames| frames of |s| into |dest| at the rate of its buffer.
+    void Read(Source& s, float* dest, int64_t frames);
+    // Move |s| to |frame| of its playback.
+    void Seek(Source& s, int64_t frame) const;
+    // Called by the UI thread.
+    bool OpenStream();
+    // Streams start reading at |from| seconds if given, where playback is expected to continue
+    // from, and otherwise at |start|.
+    std::unique_ptr<Playback> NewPlayback(std::vector<Input> inputs,
+                                          double start,
+                                          std::optional<double> end,
+                                          std::optional<double> from = std::nullopt);
+    void Send(Command command);
+    void FreeRetired();
+    void CloseStream();
+
     PaDeviceIndex output_device_;
     PaStream* stream = nullptr;
     int num_channels = 0;
     int samplerate = 0;
-    bool loop = false;
-    int start_index;
-    std::unique_ptr<AudioMixer> mixer_;
+    std::atomic<bool> loop{false};
+    SpscQueue<Command, kQueueSize> commands;
+    // Playbacks that the callback is done with. Every command retires at most three playbacks and
+    // the UI thread frees them before sending a command, so the queue never fills up.
+    SpscQueue<Playback*, 3 * kQueueSize> retired;
+    AudioStreamReader reader;
+    // Last playback sent by the UI thread.
+    Playback* current = nullptr;
+    // Latest command received by the callback that waits for its playback to be ready. The
+    // active playback continues until then.
+    std::optional<Command> pending;
+    // Playback of the callback.
+    Playback* active = nullptr;
+    // Playback that the callback fades out, and how far it has come.
+    Playback* fading = nullptr;
+    int64_t fade_index = 0;
+    int64_t crossfade_frames = 0;
+    // Output of |fading|, and of each source before it is added to the sum.
+    std::vector<float> fade_buffer;
+    std::vector<float> source_buffer;
 };
 
 #endif
@@ -0,0 +1,20 @@
+#ifndef CPU_FEATURES_HPP
+#define CPU_FEATURES_HPP
+
+// The AVX2 kernels are compiled for AVX2 through function attributes, whatever the build target,
+// and are only called when the CPU supports it. AVX2_OPS marks the operations of the kernels, and
+// AVX2_KERNEL an entry point that inlines everything it calls, so that the generic kernel
+// templates it instantiates are compiled for AVX2 as well.
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_AVX2_KERNELS 1
+#define AVX2_OPS __attribute__((target("avx2")))
+#define AVX2_KERNEL __attribute__((target("avx2"), flatten))
+
+// Decided once at startup, so that checking it costs nothing, e.g. on the audio thread.
+inline const bool kCpuHasAvx2 = [] {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+}();
+#endif
+
+#endif
@@ -0,0 +1,39 @@
+#include "fft_plans.hpp"
+#include <iostream>
+
+FftPlans::FftPlans(bool measure, std::string wisdom_file)
+    : measure(measure), wisdom_file(std::move(wisdom_file)) {
+    if (measure && !this->wisdom_file.empty()) {
+        fftwf_import_wisdom_from_filename(this->wisdom_file.c_str());
+    }
+}
+
+FftPlans::~FftPlans() {
+    std::scoped_lock lock(mutex);
+    if (new_wisdom && !wisdom_file.empty() &&
+        !fftwf_export_wisdom_to_filename(wisdom_file.c_str())) {
+        std::cerr << "FftPlans: Failed to save wisdom to " << wisdom_file << std::endl;
+    }
+    for (auto& [key, plan] : real_to_complex) {
+        fftwf_destroy_plan(plan);
+    }
+}
+
+fftwf_plan FftPlans::RealToComplex(int size, bool aligned) {
+    std::scoped_lock lock(mutex);
+    fftwf_plan& plan = real_to_complex[{size, aligned}];
+    if (plan)
+        return plan;
+
+    // Measuring overwrites the buffers, so the plan is made on buffers of its own.
+    float* input = static_cast<float*>(fftwf_malloc(size * sizeof(float)));
+    fftwf_complex* output =
+        static_cast<fftwf_complex*>(fftwf_malloc((size / 2 + 1) * sizeof(fftwf_complex)));
+    const unsigned flags =
+        (measure ? FFTW_MEASURE : FFTW_ESTIMATE) | (aligned ? 0 : FFTW_UNALIGNED);
+    plan = fftwf_plan_dft_r2c_1d(size, input, output, flags);
+    fftwf_free(input);
+    fftwf_free(output);
+    new_wisdom = new_wisdom || measure;
+    return plan;
+}
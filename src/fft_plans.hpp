@@ -0,0 +1,36 @@
+#ifndef FFT_PLANS_HPP
+#define FFT_PLANS_HPP
+
+#include <fftw3.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+// Process-wide registry of FFTW plans. A plan is created once per size and alignment and then
+// shared by all threads, which execute it on their own buffers with fftwf_execute_dft_r2c(). Only
+// the planner needs to be serialized, so the lock is held while a size is planned for the first
+// time and not while transforming.
+class FftPlans {
+   public:
+    // With |measure|, plans are measured instead of estimated. Wisdom is then loaded from and saved
+    // to |wisdom_file| unless it is empty, so that the measurement is only done once per size.
+    FftPlans(bool measure, std::string wisdom_file);
+    ~FftPlans();
+    FftPlans(const FftPlans&) = delete;
+    FftPlans& operator=(const FftPlans&) = delete;
+
+    // Plan for a real-to-complex transform of |size| samples. Buffers allocated with fftwf_malloc()
+    // are aligned; other buffers must be passed with |aligned| set to false.
+    fftwf_plan RealToComplex(int size, bool aligned = true);
+
+   private:
+    const bool measure;
+    const std::string wisdom_file;
+    bool new_wisdom = false;
+    std::mutex mutex;
+    // Keyed by size and alignment.
+    std::map<std::pair<int, bool>, fftwf_plan> real_to_complex;
+};
+
+#endif
@@ -9,71 +9,45 @@ struct vertex {
     glm::vec3 texCoord;
 };
 
-int NumTiles(int size, int max_size) {
-    int num_tiles = 1;
-    size -= max_size;
-    while (size > 0) {
-        size -= max_size - 1;
-        num_tiles++;
-    }
-    return num_tiles;
-}
+constexpr int kVerticesPerTile = 6;
 }  // namespace
 
 GpuSpectrogram::GpuSpectrogram(const Spectrogram& spectrogram, int samplerate) {
     // Time duration of one spectrum.
-    const float spectrum_duration = static_cast<float>(spectrogram.Advance()) / samplerate;
-    const int num_spectrum = spectrogram.NumPowerSpectrumPerChannel();
-
-    // Maximum supported texture size determines number of spectra per tile.
-    int num_spectra_per_tile;
-    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &num_spectra_per_tile);
-    num_spectra_per_tile = std::min(num_spectra_per_tile, num_spectrum);
-
-    // Number of tiles (depth) of texture array. Tiles share one spectrum with neighboring tiles in
-    // order to support perfect transitions between tiles.
-    const int num_tiles = NumTiles(num_spectrum, num_spectra_per_tile);
-
-    // Allocate texture storage for all tiles.
-    const int num_channels = spectrogram.NumChannels();
-    const int width = spectrogram.OutputSize();
-    tex.resize(num_channels);
-    glGenTextures(tex.size(), tex.data());
-    for (int c = 0; c < num_channels; c++) {
-        glBindTexture(GL_TEXTURE_2D_ARRAY, tex[c]);
-        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glPixelStorei(GL_PACK_ALIGNMENT, 2);
-        glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
-        glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_R16, width, num_spectra_per_tile, num_tiles);
-    }
+    const double spectrum_duration = static_cast<double>(spectrogram.Advance()) / samplerate;
+    num_channels = spectrogram.NumChannels();
+    output_size = spectrogram.OutputSize();
+    bytes_per_tile = static_cast<size_t>(num_channels) * output_size *
+                     Spectrogram::kSpectraPerTile * sizeof(uint16_t);
+    tex.resize(spectrogram.NumTiles(), 0);
 
+    // Textures of all tiles have room for kSpectraPerTile spectra, which is within the minimum
+    // GL_MAX_TEXTURE_SIZE of OpenGL ES 3 (2048). The bins of the largest FFT sizes may not be, so
+    // the FFT sizes are limited by MaxFftSize().
     std::vector<vertex> vertices;
-    for (int tile = 0; tile < num_tiles; tile++) {
-        const int first_spectrum_of_tile = tile * (num_spectra_per_tile - 1);
-        // Upload one texture tile per channel.
-        const int height = std::min((num_spectrum - first_spectrum_of_tile), num_spectra_per_tile);
-        for (int c = 0; c < num_channels; c++) {
-            glBindTexture(GL_TEXTURE_2D_ARRAY, tex[c]);
-            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, tile, width, height, 1, GL_RED,
-                            GL_UNSIGNED_SHORT, spectrogram.Data(c, first_spectrum_of_tile));
-        }
+    for (int tile = 0; tile < spectrogram.NumTiles(); tile++) {
+        const int first_spectrum_of_tile = spectrogram.FirstSpectrum(tile);
+        const int height = spectrogram.TileSize(tile);
 
         // Skip half a texel at the beginning and end of the tiles to achieve seamless borders.
-        const float tex_start = 0.5f / num_spectra_per_tile;
-        const float tex_end = (height - 0.5f) / num_spectra_per_tile;
+        const float tex_start = 0.5f / Spectrogram::kSpectraPerTile;
+        const float tex_end = (height - 0.5f) / Spectrogram::kSpectraPerTile;
 
         // Time location for this tile.
-        const float time_start = first_spectrum_of_tile * spectrum_duration;
-        const float time_end = (first_spectrum_of_tile + height - 1) * spectrum_duration;
-
-        // Vertices with texture coordinates for the tile. Same vertices are shared by all channels.
-        vertices.push_back({glm::vec2(time_start, -1.f), glm::vec3(0.f, tex_start, tile)});
-        vertices.push_back({glm::vec2(time_end, 1.f), glm::vec3(1.f, tex_end, tile)});
-        vertices.push_back({glm::vec2(time_start, 1.f), glm::vec3(1.f, tex_start, tile)});
-        vertices.push_back({glm::vec2(time_start, -1.f), glm::vec3(0.f, tex_start, tile)});
-        vertices.push_back({glm::vec2(time_end, -1.f), glm::vec3(0.f, tex_end, tile)});
-        vertices.push_back({glm::vec2(time_end, 1.f), glm::vec3(1.f, tex_end, tile)});
+        tile_start_times.push_back(first_spectrum_of_tile * spectrum_duration);
+        tile_end_times.push_back((first_spectrum_of_tile + height - 1) * spectrum_duration);
+        const float time_end = tile_end_times.back() - tile_start_times.back();
+
+        // Vertices with texture coordinates for the tile, relative to the start of the tile to
+        // keep precision in long files. Channels are layers of the texture array of the tile.
+        for (int c = 0; c < num_channels; c++) {
+            vertices.push_back({glm::vec2(0.f, -1.f), glm::vec3(0.f, tex_start, c)});
+            vertices.push_back({glm::vec2(time_end, 1.f), glm::vec3(1.f, tex_end, c)});
+            vertices.push_back({glm::vec2(0.f, 1.f), glm::vec3(1.f, tex_start, c)});
+            vertices.push_back({glm::vec2(0.f, -1.f), glm::vec3(0.f, tex_start, c)});
+            vertices.push_back({glm::vec2(time_end, -1.f), glm::vec3(0.f, tex_end, c)});
+            vertices.push_back({glm::vec2(time_end, 1.f), glm::vec3(1.f, tex_end, c)});
+        }
     }
 
     // Vertex array object for storing vertices with texture coordinates.
@@ -89,20 +63,175 @@ GpuSpectrogram::GpuSpectrogram(const Spectrogram& spectrogram, int samplerate) {
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex),
                           (const void*)offsetof(vertex, texCoord));
     glBindVertexArray(0);
-    num_vertices = vertices.size();
+}
+
+int GpuSpectrogram::MaxFftSize() {
+    static const int max_fft_size = [] {
+        GLint max_texture_size = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+        int fft_size = SpectrogramSettings::kMaxFftSize;
+        while (fft_size > SpectrogramSettings::kMinFftSize && fft_size / 2 + 1 > max_texture_size) {
+            fft_size /= 2;
+        }
+        return fft_size;
+    }();
+    return max_fft_size;
 }
 
 GpuSpectrogram::~GpuSpectrogram() {
+    CancelPending();
     glDeleteTextures(tex.size(), tex.data());
     glDeleteBuffers(1, &vbo);
     glDeleteVertexArrays(1, &vao);
 }
 
-void GpuSpectrogram::Draw(int channel) {
+bool GpuSpectrogram::Update(Spectrogram& spectrogram,
+                            double start_time,
+                            double end_time,
+                            UploadBudget& budget) {
+    if (!NumTiles())
+        return false;
+
+    // Tiles in view.
+    int first_tile = 0;
+    while (first_tile + 1 < NumTiles() && tile_end_times[first_tile] < start_time) {
+        first_tile++;
+    }
+    int last_tile = first_tile;
+    while (last_tile + 1 < NumTiles() && tile_start_times[last_tile + 1] <= end_time) {
+        last_tile++;
+    }
+    spectrogram.SetView(first_tile, last_tile);
+    view_first_tile = first_tile;
+    view_last_tile = last_tile;
+
+    // Tiles in view, followed by the other tiles ordered by distance to the view.
+    std::vector<int> order;
+    for (int tile = first_tile; tile <= last_tile; tile++) {
+        order.push_back(tile);
+    }
+    for (int d = 1; first_tile - d >= 0 || last_tile + d < NumTiles(); d++) {
+        if (first_tile - d >= 0)
+            order.push_back(first_tile - d);
+        if (last_tile + d < NumTiles())
+            order.push_back(last_tile + d);
+    }
+
+    bool missing_in_view = false;
+    for (const int tile : order) {
+        if (tex[tile])
+            continue;
+        const bool in_view = tile >= first_tile && tile <= last_tile;
+        // Tiles outside of the view are only uploaded while within budget. A partly uploaded
+        // tile is already counted.
+        const size_t new_bytes = tile == pending.tile ? 0 : bytes_per_tile;
+        if (!in_view && (budget.Exhausted() || uploaded_bytes + new_bytes > memory_budget)) {
+            break;
+        }
+        std::shared_ptr<const Spectrogram::Tile> data;
+        if (!budget.Exhausted()) {
+            data = tile == pending.tile ? pending.data : spectrogram.GetTile(tile);
+        }
+        if (!data) {
+            missing_in_view = missing_in_view || in_view;
+            continue;
+        }
+        // The rest of the tile is uploaded in the next frames.
+        if (!Upload(std::move(data), tile, budget)) {
+            missing_in_view = missing_in_view || in_view;
+            break;
+        }
+    }
+
+    while (uploaded_bytes > memory_budget && EvictFarthest(first_tile, last_tile)) {
+    }
+    return missing_in_view || pending.tile >= 0;
+}
+
+void GpuSpectrogram::SetMemoryBudget(size_t bytes) {
+    memory_budget = bytes;
+    while (uploaded_bytes > memory_budget && EvictFarthest(view_first_tile, view_last_tile)) {
+    }
+}
+
+bool GpuSpectrogram::Upload(std::shared_ptr<const Spectrogram::Tile> data,
+                            int tile,
+                            UploadBudget& budget) {
+    if (pending.tile != tile) {
+        // A tile that is no longer first in line is started over when its turn comes.
+        CancelPending();
+        pending.tile = tile;
+        pending.data = std::move(data);
+        glGenTextures(1, &pending.tex);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, pending.tex);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_R16, output_size, Spectrogram::kSpectraPerTile,
+                       num_channels);
+        uploaded_bytes += bytes_per_tile;
+    } else {
+        glBindTexture(GL_TEXTURE_2D_ARRAY, pending.tex);
+    }
+
+    // One layer per channel, uploaded in whole spectra.
+    const Spectrogram::Tile& t = *pending.data;
+    glPixelStorei(GL_PACK_ALIGNMENT, 2);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    while (pending.channel < num_channels) {
+        const int spectra = budget.Take(t.NumSpectra() - pending.spectrum,
+                                        static_cast<size_t>(output_size) * sizeof(uint16_t));
+        if (!spectra)
+            break;
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, pending.spectrum, pending.channel, output_size,
+                        spectra, 1, GL_RED, GL_UNSIGNED_SHORT,
+                        t.Data(pending.channel, pending.spectrum));
+        pending.spectrum += spectra;
+        if (pending.spectrum == t.NumSpectra()) {
+            pending.channel++;
+            pending.spectrum = 0;
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    if (pending.channel < num_channels)
+        return false;
+
+    tex[tile] = pending.tex;
+    pending = {};
+    return true;
+}
+
+void GpuSpectrogram::CancelPending() {
+    if (pending.tile < 0)
+        return;
+    glDeleteTextures(1, &pending.tex);
+    uploaded_bytes -= bytes_per_tile;
+    pending = {};
+}
+
+bool GpuSpectrogram::EvictFarthest(int first_tile, int last_tile) {
+    int farthest = -1;
+    int max_distance = 0;
+    for (int tile = 0; tile < NumTiles(); tile++) {
+        const int distance = std::max(first_tile - tile, tile - last_tile);
+        if (tex[tile] && distance > max_distance) {
+            farthest = tile;
+            max_distance = distance;
+        }
+    }
+    if (farthest < 0)
+        return false;
+    glDeleteTextures(1, &tex[farthest]);
+    tex[farthest] = 0;
+    uploaded_bytes -= bytes_per_tile;
+    return true;
+}
+
+void GpuSpectrogram::DrawTile(int channel, int tile) {
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D_ARRAY, tex[channel]);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, tex[tile]);
     glBindVertexArray(vao);
-    glDrawArrays(GL_TRIANGLES, 0, num_vertices);
+    glDrawArrays(GL_TRIANGLES, (tile * num_channels + channel) * kVerticesPerTile,
+                 kVerticesPerTile);
     glBindVertexArray(0);
     glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
 }
@@ -5,18 +5,68 @@
 #define GL_GLEXT_PROTOTYPES
 #include <GL/gl.h>
 #include <vector>
+#include "upload_budget.hpp"
 
+// Spectrogram tiles in GPU memory. Tiles are uploaded as they are computed and the tiles farthest
+// from the view are deleted when over the memory budget that the resource manager gives the
+// track. A tile that does not fit in the upload budget of a frame is uploaded over several frames
+// and drawn once it is complete.
 class GpuSpectrogram {
    public:
     GpuSpectrogram(const Spectrogram& spectrogram, int samplerate);
     ~GpuSpectrogram();
-    void Draw(int channel);
+    // Largest FFT size up to SpectrogramSettings::kMaxFftSize whose bins fit in the width of a
+    // texture, from GL_MAX_TEXTURE_SIZE of the current context the first time it is called.
+    static int MaxFftSize();
+    // Request the tiles from |start_time| to |end_time| from |spectrogram| and upload computed
+    // tiles within |budget|. Returns true while tiles in view are missing or a tile is partly
+    // uploaded.
+    bool Update(Spectrogram& spectrogram,
+                double start_time,
+                double end_time,
+                UploadBudget& budget);
+    int NumTiles() const { return tile_start_times.size(); }
+    bool HasTile(int tile) const { return tex[tile] != 0; }
+    // Vertices of a tile are positioned relative to its start time.
+    double TileStartTime(int tile) const { return tile_start_times[tile]; }
+    double TileEndTime(int tile) const { return tile_end_times[tile]; }
+    void DrawTile(int channel, int tile);
+    // Memory of the uploaded tiles.
+    size_t MemoryUsage() const { return uploaded_bytes; }
+    // Delete the tiles farthest from the view of the last Update() until within |bytes|, and
+    // upload no more than fit. Tiles in view are uploaded and kept regardless.
+    void SetMemoryBudget(size_t bytes);
 
    private:
+    // Tile whose texture is partly uploaded, and the next spectrum to upload.
+    struct PendingUpload {
+        int tile = -1;
+        GLuint tex = 0;
+        std::shared_ptr<const Spectrogram::Tile> data;
+        int channel = 0;
+        int spectrum = 0;
+    };
+
+    // Continue or start the upload of |tile|. Returns true when the tile is complete.
+    bool Upload(std::shared_ptr<const Spectrogram::Tile> data, int tile, UploadBudget& budget);
+    void CancelPending();
+    // Delete the tile farthest from the view, unless all tiles are in view.
+    bool EvictFarthest(int first_tile, int last_tile);
+
+    int num_channels = 0;
+    int output_size = 0;
     GLuint vao = 0;
     GLuint vbo = 0;
-    GLsizei num_vertices = 0;
+    // Texture array per tile with one layer per channel, or 0 if not uploaded.
     std::vector<GLuint> tex;
+    std::vector<double> tile_start_times;
+    std::vector<double> tile_end_times;
+    PendingUpload pending;
+    size_t bytes_per_tile = 0;
+    size_t uploaded_bytes = 0;
+    size_t memory_budget = 0;
+    int view_first_tile = 0;
+    int view_last_tile = 0;
 };
 
 #endif
@@ -1,60 +1,226 @@
 #include "gpu_waveform.hpp"
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 
-GpuWaveform::GpuWaveform(const AudioBuffer& ab, const std::vector<float>& buffer_lod) {
+GpuWaveform::GpuWaveform(const AudioBuffer& ab, const LowResWaveform& low_res) {
     num_channels = ab.NumChannels();
-    num_vertices = ab.NumFrames();
     samplerate = ab.Samplerate();
 
+    const int num_levels = 1 + low_res.NumLevels();
+    vbo.resize(num_levels);
     glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, ab.NumChannels() * ab.NumFrames() * sizeof(float), ab.Samples(),
-                 GL_STATIC_DRAW);
+    glGenBuffers(num_levels, vbo.data());
+
+    // Samples are uploaded in their own type. 16-bit samples are normalized to [-1, 1] by the GPU.
+    const bool int16 = ab.Type() == INT16;
+    vertex_type.push_back(int16 ? GL_SHORT : GL_FLOAT);
+    vertex_size.push_back(int16 ? sizeof(int16_t) : sizeof(float));
+    // Short files need fewer pages.
+    const int64_t file_pages = (ab.NumFrames() + kFramesPerPage - 1) / kFramesPerPage;
+    pages.resize(std::min<int64_t>(kNumPages, file_pages));
+    glBindBuffer(GL_ARRAY_BUFFER, vbo[0]);
+    allocated_bytes = pages.size() * PageBytes();
+    glBufferData(GL_ARRAY_BUFFER, allocated_bytes, nullptr, GL_DYNAMIC_DRAW);
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 1, GL_FLOAT, GL_FALSE, 0, nullptr);
+    num_vertices.push_back(0);
+    samples_per_vertex.push_back(1.0);
 
-    num_vertices_lod = num_channels ? buffer_lod.size() / num_channels : 0;
-    glGenBuffers(1, &vbo_lod);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo_lod);
-    glBufferData(GL_ARRAY_BUFFER, buffer_lod.size() * sizeof(float), buffer_lod.data(),
-                 GL_STATIC_DRAW);
+    for (int level = 1; level < num_levels; level++) {
+        glBindBuffer(GL_ARRAY_BUFFER, vbo[level]);
+        const size_t bytes = low_res.Size(level - 1) * sizeof(float);
+        glBufferData(GL_ARRAY_BUFFER, bytes, nullptr, GL_STATIC_DRAW);
+        allocated_bytes += bytes;
+        vertex_type.push_back(GL_FLOAT);
+        vertex_size.push_back(sizeof(float));
+        num_vertices.push_back(0);
+        // A min and a max vertex per block.
+        samples_per_vertex.push_back(low_res.Factor(level - 1) / 2.0);
+    }
     glBindVertexArray(0);
 }
 
+bool GpuWaveform::Update(const AudioBuffer& ab,
+                         const LowResWaveform& low_res,
+                         double start_time,
+                         double end_time,
+                         UploadBudget& budget) {
+    if (!num_channels)
+        return false;
+
+    // Check for completion before counting, so that nothing that is counted is missed.
+    const bool complete = ab.Loaded() && low_res.Complete();
+    num_vertices[0] = ab.LoadedFrames();
+
+    // Page in the samples in view and a page on each side, if they fit in the ring.
+    const int64_t first_page = std::max<int64_t>(StartIndex(start_time, 0) / kFramesPerPage - 1, 0);
+    const int64_t last_page =
+        std::min(StartIndex(end_time, 0) / kFramesPerPage + 1,
+                 (ab.NumFrames() + kFramesPerPage - 1) / kFramesPerPage - 1);
+    view_resident = last_page - first_page < static_cast<int64_t>(pages.size());
+    bool pending = view_resident && UploadPages(ab, first_page, last_page, budget);
+
+    // Coarse levels are small and cover long views, so they are uploaded first.
+    for (int level = static_cast<int>(vbo.size()) - 1; level >= 1; level--) {
+        const int64_t vertices = low_res.ComputedSize(level - 1) / num_channels;
+        if (vertices <= num_vertices[level])
+            continue;
+        const size_t row_size = num_channels * vertex_size[level];
+        const int64_t n = budget.Take(vertices - num_vertices[level], row_size);
+        pending = pending || num_vertices[level] + n < vertices;
+        if (!n)
+            continue;
+        const auto* data = reinterpret_cast<const uint8_t*>(low_res.Data(level - 1));
+        glBindBuffer(GL_ARRAY_BUFFER, vbo[level]);
+        glBufferSubData(GL_ARRAY_BUFFER, num_vertices[level] * row_size, n * row_size,
+                        data + num_vertices[level] * row_size);
+        num_vertices[level] += n;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return !complete || pending;
+}
+
+bool GpuWaveform::UploadPages(const AudioBuffer& ab,
+                              int64_t first_page,
+                              int64_t last_page,
+                              UploadBudget& budget) {
+    // Mark the resident pages first, so that they are not replaced by the others.
+    update_count++;
+    for (int64_t page = first_page; page <= last_page; page++) {
+        const int slot = Slot(page);
+        if (slot >= 0) {
+            pages[slot].last_used = update_count;
+        }
+    }
+
+    const size_t row_size = num_channels * vertex_size[0];
+    bool pending = false;
+    glBindBuffer(GL_ARRAY_BUFFER, vbo[0]);
+    for (int64_t page = first_page; page <= last_page; page++) {
+        int slot = Slot(page);
+        if (slot < 0) {
+            slot = 0;
+            for (int i = 1; i < static_cast<int>(pages.size()); i++) {
+                if (pages[i].last_used < pages[slot].last_used)
+                    slot = i;
+            }
+            pages[slot] = {page, 0, update_count};
+        }
+
+        // Pages are filled as the audio is loaded.
+        Page& p = pages[slot];
+        const int64_t first_frame = page * kFramesPerPage;
+        const int64_t frames =
+            std::clamp(num_vertices[0] - first_frame, int64_t{0}, kFramesPerPage + 1);
+        if (frames <= p.uploaded_frames)
+            continue;
+        const int64_t n = budget.Take(frames - p.uploaded_frames, row_size);
+        pending = pending || p.uploaded_frames + n < frames;
+        if (!n)
+            continue;
+        const auto* data = static_cast<const uint8_t*>(ab.Data());
+        glBufferSubData(GL_ARRAY_BUFFER, slot * PageBytes() + p.uploaded_frames * row_size,
+                        n * row_size, data + (first_frame + p.uploaded_frames) * row_size);
+        p.uploaded_frames += n;
+    }
+    return pending;
+}
+
+int GpuWaveform::Slot(int64_t page) const {
+    for (int slot = 0; slot < static_cast<int>(pages.size()); slot++) {
+        if (pages[slot].index == page)
+            return slot;
+    }
+    return -1;
+}
+
 GpuWaveform::~GpuWaveform() {
-    glDeleteBuffers(1, &vbo);
-    glDeleteBuffers(1, &vbo_lod);
+    glDeleteBuffers(vbo.size(), vbo.data());
     glDeleteVertexArrays(1, &vao);
 }
 
+int GpuWaveform::Level(double samples_per_pixel) const {
+    // The pyramid covers the whole file.
+    int level = view_resident || samples_per_vertex.size() == 1 ? 0 : 1;
+    while (level + 1 < static_cast<int>(samples_per_vertex.size()) &&
+           samples_per_vertex[level + 1] <= samples_per_pixel) {
+        level++;
+    }
+    return level;
+}
+
+double GpuWaveform::Rate(int level) const {
+    return samplerate / samples_per_vertex[level];
+}
+
+int64_t GpuWaveform::StartIndex(double start_time, int level) const {
+    return std::max(static_cast<int64_t>(std::floor(start_time * Rate(level))), int64_t{0});
+}
+
+void GpuWaveform::DrawRun(int channel,
+                          int level,
+                          size_t offset,
+                          int64_t first_index,
+                          int64_t last_index,
+                          bool draw_points,
+                          const SetOrigin& set_origin) {
+    if (last_index < first_index)
+        return;
+    set_origin(first_index / Rate(level));
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo[level]);
+    glVertexAttribPointer(0, 1, vertex_type[level], vertex_type[level] != GL_FLOAT,
+                          num_channels * vertex_size[level],
+                          (const void*)(offset + channel * vertex_size[level]));
+    glDrawArrays(draw_points ? GL_POINTS : GL_LINE_STRIP, 0,
+                 static_cast<GLsizei>(last_index - first_index + 1));
+}
+
 void GpuWaveform::Draw(int channel,
-                       float start_time,
-                       float end_time,
-                       bool draw_low_res,
-                       bool draw_points) {
-    const float rate = draw_low_res ? samplerate / 1000.f * 2.f : samplerate;
-    const int last_index = (draw_low_res ? num_vertices_lod : num_vertices) - 1;
-    const int start_index = std::max(static_cast<int>(std::floor(start_time * rate)), 0);
-    const int end_index = std::min(
-        start_index + static_cast<int>(std::ceil((end_time - start_time) * rate)), last_index);
+                       double start_time,
+                       double end_time,
+                       int level,
+                       bool draw_points,
+                       const SetOrigin& set_origin) {
+    const double rate = Rate(level);
+    const int64_t last_index = num_vertices[level] - 1;
+    const int64_t start_index = StartIndex(start_time, level);
+    const int64_t end_index = std::min(
+        start_index + static_cast<int64_t>(std::ceil((end_time - start_time) * rate)), last_index);
+    const size_t row_size = num_channels * vertex_size[level];
+    if (level > 0) {
+        DrawRun(channel, level, start_index * row_size, start_index, end_index, draw_points,
+                set_origin);
+        return;
+    }
 
-    if (end_index >= start_index) {
-        glBindVertexArray(vao);
-        glBindBuffer(GL_ARRAY_BUFFER, draw_low_res ? vbo_lod : vbo);
-        glVertexAttribPointer(
-            0, 1, GL_FLOAT, GL_FALSE, num_channels * sizeof(float),
-            (const void*)((start_index * num_channels + channel) * sizeof(float)));
-        glDrawArrays(draw_points ? GL_POINTS : GL_LINE_STRIP, 0, end_index - start_index + 1);
+    // Samples are drawn in a run per page.
+    for (int64_t page = start_index / kFramesPerPage; page <= end_index / kFramesPerPage;
+         page++) {
+        const int slot = Slot(page);
+        if (slot < 0)
+            continue;
+        const int64_t first_frame = page * kFramesPerPage;
+        const int64_t first = std::max(start_index, first_frame);
+        const int64_t last = std::min(end_index, first_frame + pages[slot].uploaded_frames - 1);
+        DrawRun(channel, 0, slot * PageBytes() + (first - first_frame) * row_size, first, last,
+                draw_points, set_origin);
     }
 }
 
-void GpuWaveform::DrawLines(int channel, float start_time, float end_time, bool draw_low_res) {
-    Draw(channel, start_time, end_time, draw_low_res, false);
+void GpuWaveform::DrawLines(int channel,
+                            double start_time,
+                            double end_time,
+                            int level,
+                            const SetOrigin& set_origin) {
+    Draw(channel, start_time, end_time, level, false, set_origin);
 }
 
-void GpuWaveform::DrawPoints(int channel, float start_time, float end_time, bool draw_low_res) {
-    Draw(channel, start_time, end_time, draw_low_res, true);
+void GpuWaveform::DrawPoints(int channel,
+                             double start_time,
+                             double end_time,
+                             int level,
+                             const SetOrigin& set_origin) {
+    Draw(channel, start_time, end_time, level, true, set_origin);
 }
@@ -3,23 +3,101 @@
 
 #define GL_GLEXT_PROTOTYPES
 #include <GL/gl.h>
+#include <functional>
 #include "audio_buffer.hpp"
+#include "low_res_waveform.hpp"
+#include "upload_budget.hpp"
 
+// Waveform vertices on the GPU. Level 0 holds samples in the type of the audio buffer, the
+// following levels hold the min/max pyramid of LowResWaveform. The pyramid is allocated for the
+// whole file and filled as the audio is loaded and the pyramid is computed. Level 0 is only drawn
+// for short views, so it is a ring of fixed-size pages that holds the samples around the view.
 class GpuWaveform {
    public:
-    GpuWaveform(const AudioBuffer& ab, const std::vector<float>& buffer_lod);
+    static constexpr int64_t kFramesPerPage = 1 << 14;
+    // Level 0 is drawn below kFirstLevelFactor / 2 samples per pixel, so the pages cover the view
+    // of windows that are many thousand pixels wide.
+    static constexpr int kNumPages = 16;
+
+    // Called before drawing a run of consecutive vertices with the time of its first vertex.
+    // Vertices are positioned relative to this time.
+    using SetOrigin = std::function<void(double first_vertex_time)>;
+
+    GpuWaveform(const AudioBuffer& ab, const LowResWaveform& low_res);
     ~GpuWaveform();
-    void DrawLines(int channel, float start_time, float end_time, bool draw_low_res);
-    void DrawPoints(int channel, float start_time, float end_time, bool draw_low_res);
+    // Upload the blocks that are new since the last update, and the samples from |start_time| to
+    // |end_time| if the view is short enough, as far as |budget| allows. Returns true until
+    // everything is uploaded.
+    bool Update(const AudioBuffer& ab,
+                const LowResWaveform& low_res,
+                double start_time,
+                double end_time,
+                UploadBudget& budget);
+    // Coarsest level where every drawn vertex covers at most about one pixel. Level 0 is only
+    // picked when the samples in view are resident.
+    int Level(double samples_per_pixel) const;
+    // Vertices per second on a level.
+    double Rate(int level) const;
+    // Memory of the vertex buffers.
+    size_t MemoryUsage() const { return allocated_bytes; }
+    void DrawLines(int channel,
+                   double start_time,
+                   double end_time,
+                   int level,
+                   const SetOrigin& set_origin);
+    void DrawPoints(int channel,
+                    double start_time,
+                    double end_time,
+                    int level,
+                    const SetOrigin& set_origin);
 
    private:
-    void Draw(int channel, float start_time, float end_time, bool draw_low_res, bool draw_points);
+    // Page of samples in a slot of the ring. A page holds one frame more than kFramesPerPage, the
+    // first frame of the next page, so that lines continue between pages.
+    struct Page {
+        int64_t index = -1;
+        int64_t uploaded_frames = 0;
+        uint64_t last_used = 0;
+    };
+
+    // Upload the pages from |first_page| to |last_page|, replacing the least recently used pages.
+    // Returns true if frames are left for a later frame.
+    bool UploadPages(const AudioBuffer& ab,
+                     int64_t first_page,
+                     int64_t last_page,
+                     UploadBudget& budget);
+    // Slot of a page, or -1 if not resident.
+    int Slot(int64_t page) const;
+    size_t PageBytes() const { return (kFramesPerPage + 1) * num_channels * vertex_size[0]; }
+    int64_t StartIndex(double start_time, int level) const;
+    void DrawRun(int channel,
+                 int level,
+                 size_t offset,
+                 int64_t first_index,
+                 int64_t last_index,
+                 bool draw_points,
+                 const SetOrigin& set_origin);
+    void Draw(int channel,
+              double start_time,
+              double end_time,
+              int level,
+              bool draw_points,
+              const SetOrigin& set_origin);
     GLuint vao = 0;
-    GLuint vbo = 0;
-    GLuint vbo_lod = 0;
+    std::vector<GLuint> vbo;
+    // Number of uploaded vertices per channel and number of samples per vertex on each level.
+    // Level 0 counts the loaded frames, of which the resident pages are uploaded.
+    std::vector<int64_t> num_vertices;
+    std::vector<double> samples_per_vertex;
+    // Attribute type and size in bytes of the vertices on each level.
+    std::vector<GLenum> vertex_type;
+    std::vector<size_t> vertex_size;
+    std::vector<Page> pages;
+    uint64_t update_count = 0;
+    // The pages cover the view of the last update.
+    bool view_resident = false;
+    size_t allocated_bytes = 0;
     int num_channels = 0;
-    int num_vertices = 0;
-    int num_vertices_lod = 0;
     int samplerate = 0;
 };
 
@@ -1,36 +1,170 @@
 #include "low_res_waveform.hpp"
 #include <iostream>
+#include <limits>
+
+#include "min_max.hpp"
+#include "task_scheduler.hpp"
 
 namespace {
-void MakeLowResBuffer(std::vector<float>& buffer,
+// Blocks are independent, so they are reduced in parallel chunks.
+constexpr int64_t kBlocksPerChunk = 4096;
+// Samples that are not floats are converted this many blocks at a time.
+constexpr int64_t kBlocksPerConversion = 16;
+
+// Compute the blocks from |first_block| to |last_block| of the first level.
+void MakeLowResBlocks(float* buffer,
                       const AudioBuffer& ab,
-                      const int down_sampling_factor) {
+                      const int64_t num_frames,
+                      const int down_sampling_factor,
+                      const int64_t first_block,
+                      const int64_t last_block,
+                      const CancellationToken& cancel) {
     const int num_channels = ab.NumChannels();
-    const int num_vertices = ab.NumFrames();
-    const float* samples = ab.Samples();
-
-    // Each channel has 2 output samples for every 1000 input samples.
-    buffer.resize(2 * num_channels *
-                  ((num_vertices + down_sampling_factor - 1) / down_sampling_factor));
-
-    int dest_idx = 0;
-    for (int i = 0; i < num_vertices; i += down_sampling_factor) {
-        const int end = std::min(i + down_sampling_factor, num_vertices);
-        for (int c = 0; c < num_channels; c++) {
-            float min = 1.f;
-            float max = -1.f;
-            for (int k = i; k < end; k++) {
-                min = std::min(min, samples[num_channels * k + c]);
-                max = std::max(max, samples[num_channels * k + c]);
+
+    // Each channel has 2 output samples for every down_sampling_factor input samples.
+    const int64_t num_chunks = (last_block - first_block + kBlocksPerChunk - 1) / kBlocksPerChunk;
+    TaskScheduler::ParallelFor(num_chunks, [&](int64_t chunk) {
+        if (cancel.Cancelled())
+            return;
+        const int64_t block = first_block + chunk * kBlocksPerChunk;
+        const int64_t first_frame = block * down_sampling_factor;
+        const int64_t frames =
+            std::min(std::min(kBlocksPerChunk, last_block - block) * down_sampling_factor,
+                     num_frames - first_frame);
+        if (ab.Type() == FLOAT32) {
+            MinMaxBlocks(static_cast<const float*>(ab.Data()) + num_channels * first_frame,
+                         num_channels, frames, down_sampling_factor,
+                         &buffer[2 * num_channels * block]);
+            return;
+        }
+        const int64_t conversion_frames = kBlocksPerConversion * down_sampling_factor;
+        std::vector<float> converted(conversion_frames * num_channels);
+        for (int64_t offset = 0; offset < frames; offset += conversion_frames) {
+            const int64_t n = std::min(conversion_frames, frames - offset);
+            ab.ReadFloat(first_frame + offset, n, converted.data());
+            MinMaxBlocks(converted.data(), num_channels, n, down_sampling_factor,
+                         &buffer[2 * num_channels * (block + offset / down_sampling_factor)]);
+        }
+    });
+}
+
+// Decimate a min/max buffer further by combining |factor| consecutive blocks of the
+// |num_prev_blocks| blocks in |prev|, computing the blocks from |first_block| to |last_block|.
+void MakeNextLevelBlocks(float* buffer,
+                         const float* prev,
+                         const int64_t num_prev_blocks,
+                         const int num_channels,
+                         const int factor,
+                         const int64_t first_block,
+                         const int64_t last_block) {
+    const size_t block_size = 2 * num_channels;
+    const int64_t num_chunks = (last_block - first_block + kBlocksPerChunk - 1) / kBlocksPerChunk;
+    TaskScheduler::ParallelFor(num_chunks, [&](int64_t chunk) {
+        const int64_t begin_block = first_block + chunk * kBlocksPerChunk;
+        const int64_t end_block = std::min(begin_block + kBlocksPerChunk, last_block);
+        for (int64_t block = begin_block; block < end_block; block++) {
+            const int64_t begin = block * factor;
+            const int64_t end = std::min(begin + factor, num_prev_blocks);
+            const size_t dest_idx = block_size * block;
+            for (int c = 0; c < num_channels; c++) {
+                float min = std::numeric_limits<float>::max();
+                float max = std::numeric_limits<float>::lowest();
+                for (int64_t k = begin; k < end; k++) {
+                    min = std::min(min, prev[block_size * k + c]);
+                    max = std::max(max, prev[block_size * k + c + num_channels]);
+                }
+                buffer[dest_idx + c] = min;
+                buffer[dest_idx + c + num_channels] = max;
             }
-            buffer[dest_idx + c] = min;
-            buffer[dest_idx + c + num_channels] = max;
         }
-        dest_idx += 2 * num_channels;
-    }
+    });
 }
 }  // namespace
 
-LowResWaveform::LowResWaveform(const AudioBuffer& ab) {
-    MakeLowResBuffer(buffer, ab, 1000);
+LowResWaveform::LowResWaveform(const AudioBuffer& ab) : num_channels(ab.NumChannels()) {
+    if (!num_channels) {
+        complete = true;
+        return;
+    }
+
+    // Add levels until a single block covers the whole file.
+    const size_t block_size = 2 * num_channels;
+    int64_t num_blocks = (ab.NumFrames() + kFirstLevelFactor - 1) / kFirstLevelFactor;
+    storage.emplace_back(block_size * num_blocks);
+    while (num_blocks > 1) {
+        num_blocks = (num_blocks + kLevelFactor - 1) / kLevelFactor;
+        storage.emplace_back(block_size * num_blocks);
+    }
+
+    for (const std::vector<float>& buffer : storage) {
+        levels.push_back({buffer.data(), buffer.size()});
+    }
+    computed_blocks.resize(storage.size(), 0);
+}
+
+LowResWaveform::LowResWaveform(std::unique_ptr<MappedFile> mapping,
+                               int num_channels,
+                               std::vector<Level> levels)
+    : num_channels(num_channels),
+      levels(std::move(levels)),
+      mapping(std::move(mapping)),
+      complete(true) {}
+
+void LowResWaveform::Update(const AudioBuffer& ab, const CancellationToken& cancel) {
+    if (Complete())
+        return;
+
+    // Only whole blocks are computed until the end of the file is loaded.
+    const bool loaded = ab.Loaded();
+    const int64_t frames = ab.LoadedFrames();
+    auto num_blocks = [loaded](int64_t n, int64_t factor) {
+        return loaded ? (n + factor - 1) / factor : n / factor;
+    };
+
+    int64_t blocks = num_blocks(frames, kFirstLevelFactor);
+    MakeLowResBlocks(storage[0].data(), ab, frames, kFirstLevelFactor, computed_blocks[0], blocks,
+                     cancel);
+    if (cancel.Cancelled())
+        return;
+    computed_blocks[0] = blocks;
+
+    for (size_t level = 1; level < storage.size(); level++) {
+        const int64_t prev_blocks = blocks;
+        blocks = num_blocks(prev_blocks, kLevelFactor);
+        MakeNextLevelBlocks(storage[level].data(), storage[level - 1].data(), prev_blocks,
+                            num_channels, kLevelFactor, computed_blocks[level], blocks);
+        computed_blocks[level] = blocks;
+    }
+
+    computed_frames.store(frames, std::memory_order_release);
+    if (loaded) {
+        complete.store(true, std::memory_order_release);
+    }
+}
+
+size_t LowResWaveform::ComputedSize(int level) const {
+    if (mapping)
+        return levels[level].size;
+    // Completion is checked first, so that the frames are final if complete.
+    const bool all_blocks = Complete();
+    const int64_t frames = ComputedFrames();
+    const int64_t factor = Factor(level);
+    const int64_t blocks = all_blocks ? (frames + factor - 1) / factor : frames / factor;
+    return 2 * num_channels * blocks;
+}
+
+size_t LowResWaveform::MemoryUsage() const {
+    size_t bytes = 0;
+    for (const std::vector<float>& buffer : storage) {
+        bytes += buffer.size() * sizeof(float);
+    }
+    return bytes;
+}
+
+int64_t LowResWaveform::Factor(int level) const {
+    int64_t factor = kFirstLevelFactor;
+    for (int i = 0; i < level; i++) {
+        factor *= kLevelFactor;
+    }
+    return factor;
 }
@@ -1,16 +1,63 @@
 #ifndef LOW_RES_WAVEFORM_HPP
 #define LOW_RES_WAVEFORM_HPP
 
+#include <atomic>
+#include <memory>
+#include <vector>
+
 #include "audio_buffer.hpp"
+#include "mapped_file.hpp"
 
+// Pyramid of min/max decimated waveforms. Every level stores a minimum and a maximum per channel
+// for each block of samples, i.e. two vertices per block. The first level has blocks of
+// kFirstLevelFactor samples and every following level is kLevelFactor times coarser.
 class LowResWaveform {
    public:
+    static constexpr int kFirstLevelFactor = 16;
+    static constexpr int kLevelFactor = 4;
+
+    struct Level {
+        const float* data;
+        size_t size;
+    };
+
+    // Levels for all frames of |ab|, computed by Update() as the frames are loaded.
     LowResWaveform(const AudioBuffer& ab);
+    // Levels that point into a memory-mapped file, e.g. from the analysis cache.
+    LowResWaveform(std::unique_ptr<MappedFile> mapping,
+                   int num_channels,
+                   std::vector<Level> levels);
     ~LowResWaveform() = default;
-    const std::vector<float>& GetBuffer() { return buffer; }
+    // Compute the blocks of the frames of |ab| that were loaded since the last update. Not
+    // thread-safe with itself, but other threads can use the computed blocks meanwhile.
+    void Update(const AudioBuffer& ab, const CancellationToken& cancel = {});
+    // All blocks are computed, i.e. the audio buffer was completely loaded.
+    bool Complete() const { return complete.load(std::memory_order_acquire); }
+    // Frames covered by the computed blocks.
+    int64_t ComputedFrames() const { return computed_frames.load(std::memory_order_acquire); }
+    int NumChannels() const { return num_channels; }
+    int NumLevels() const { return levels.size(); }
+    // Number of audio samples per min/max pair on a level.
+    int64_t Factor(int level) const;
+    const float* Data(int level) const { return levels[level].data; }
+    // Number of floats allocated on a level.
+    size_t Size(int level) const { return levels[level].size; }
+    // Number of floats on a level that are computed. Once complete, this is the size of the level
+    // for the final length of the file, which can be shorter than its header said.
+    size_t ComputedSize(int level) const;
+    // Memory of the levels, not counting levels in a mapped file.
+    size_t MemoryUsage() const;
 
    private:
-    std::vector<float> buffer;
+    int num_channels = 0;
+    std::vector<Level> levels;
+    // Backing storage of |levels|, either computed or mapped.
+    std::vector<std::vector<float>> storage;
+    std::unique_ptr<MappedFile> mapping;
+    // Blocks computed so far on each level, used by Update().
+    std::vector<int64_t> computed_blocks;
+    std::atomic<int64_t> computed_frames{0};
+    std::atomic<bool> complete{false};
 };
 
 #endif
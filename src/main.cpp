@@ -3,9 +3,13 @@
 #include <SDL3/SDL_init.h>
 #include <SDL3/SDL_mouse.h>
 #include <getopt.h>
+#include <unistd.h>
+#include <cstdlib>
 #include <iostream>
 #include <system_error>
+#include "analysis_cache.hpp"
 #include "audio_system.hpp"
+#include "fft_plans.hpp"
 #include "file_load_server.hpp"
 #include "imgui.h"
 #include "imgui_impl_opengl3.h"
@@ -15,27 +19,59 @@
 #include "spectrum_state.hpp"
 #include "spectrum_window.hpp"
 #include "state.hpp"
+#include "task_scheduler.hpp"
 
 namespace {
 struct Time {
-    Time(float seconds) {
-        min = std::floor(seconds / 60.0f);
-        sec = seconds - 60.0f * min;
+    Time(double seconds) {
+        min = std::floor(seconds / 60.0);
+        sec = seconds - 60.0 * min;
     }
-    float min;
-    float sec;
+    double min;
+    double sec;
 };
 
 void print_usage(const std::string& prog_name) {
     std::cerr << "usage: " << prog_name << " [OPTIONS] FILE" << std::endl;
-    std::cerr << "  -d, --detach  Run a different instance of wavey." << std::endl;
-    std::cerr << "  -h, --help    Print this help message." << std::endl;
+    std::cerr << "  -d, --detach       Run a different instance of wavey." << std::endl;
+    std::cerr << "  -m, --measure-fft  Measure FFT plans and save the FFTW wisdom in the cache."
+              << std::endl;
+    std::cerr << "  -j, --threads=N    Number of threads for loading and analysis. Defaults to the"
+              << std::endl;
+    std::cerr << "                     number of hardware threads." << std::endl;
+    std::cerr << "  -D, --decode-threads=N" << std::endl;
+    std::cerr << "                     Number of threads decoding one compressed file. Defaults to"
+              << std::endl;
+    std::cerr << "                     all threads." << std::endl;
+    std::cerr << "  -M, --memory=MB    Memory for samples and analysis of all tracks. Defaults to"
+              << std::endl;
+    std::cerr << "                     half of the physical memory." << std::endl;
+    std::cerr << "  -G, --gpu-memory=MB" << std::endl;
+    std::cerr << "                     GPU memory for waveforms and spectrograms of all tracks."
+              << std::endl;
+    std::cerr << "                     Defaults to 2048." << std::endl;
+    std::cerr << "  -h, --help         Print this help message." << std::endl;
+}
+
+// ImGui needs a few frames after input to settle, e.g. for hover effects.
+constexpr int kFramesAfterInput = 3;
+// Background tasks are shown in the status bar, so their progress is polled while waiting for
+// input.
+constexpr int kPollIntervalMs = 250;
+
+// Half of the physical memory.
+size_t DefaultMemoryBudget() {
+    const long pages = sysconf(_SC_PHYS_PAGES);
+    const long page_size = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || page_size <= 0)
+        return size_t{4096} << 20;
+    return static_cast<size_t>(pages) * page_size / 2;
 }
 
 }  // namespace
 
-float scroll_value = 0.0f;
-float scroll_max = 0.0f;
+double scroll_value = 0.0;
+double scroll_max = 0.0;
 float timeline_height = 0.0f;
 float status_bar_height = 0.0f;
 float mouse_x = 0.0f;
@@ -44,16 +80,26 @@ bool mouse_down = false;
 
 int main(int argc, char** argv) {
     bool run_file_load_server = true;
+    bool measure_fft = false;
+    int num_threads = 0;
+    int decode_threads = 0;
+    size_t memory_budget = DefaultMemoryBudget();
+    size_t gpu_memory_budget = size_t{2048} << 20;
 
     const struct option long_options[] = {
         {"detach", no_argument, 0, 'd'},
+        {"measure-fft", no_argument, 0, 'm'},
+        {"threads", required_argument, 0, 'j'},
+        {"decode-threads", required_argument, 0, 'D'},
+        {"memory", required_argument, 0, 'M'},
+        {"gpu-memory", required_argument, 0, 'G'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0},
     };
 
     for (;;) {
         int option_index = 0;
-        int c = getopt_long(argc, argv, "dh", long_options, &option_index);
+        int c = getopt_long(argc, argv, "dmj:D:M:G:h", long_options, &option_index);
         if (c == -1)
             break;
 
@@ -61,6 +107,34 @@ int main(int argc, char** argv) {
             case 'd':
                 run_file_load_server = false;
                 break;
+            case 'm':
+                measure_fft = true;
+                break;
+            case 'j':
+                num_threads = std::atoi(optarg);
+                if (num_threads <= 0) {
+                    std::cerr << "Invalid number of threads: " << optarg << std::endl;
+                    return -1;
+                }
+                break;
+            case 'D':
+                decode_threads = std::atoi(optarg);
+                if (decode_threads <= 0) {
+                    std::cerr << "Invalid number of decode threads: " << optarg << std::endl;
+                    return -1;
+                }
+                break;
+            case 'M':
+            case 'G': {
+                const long long megabytes = std::atoll(optarg);
+                if (megabytes <= 0) {
+                    std::cerr << "Invalid amount of memory: " << optarg << std::endl;
+                    return -1;
+                }
+                (c == 'M' ? memory_budget : gpu_memory_budget) =
+                    static_cast<size_t>(megabytes) << 20;
+                break;
+            }
             case 'h':
                 print_usage(argv[0]);
                 return -1;
@@ -96,10 +170,23 @@ int main(int argc, char** argv) {
     SDL_SetEventEnabled(SDL_EVENT_DROP_FILE, true);
 
 
-    std::mutex fftw_mutex;
+    const std::string cache_directory = AnalysisCache::DefaultDirectory();
+    const AnalysisCache analysis_cache;
+    FftPlans fft_plans(measure_fft,
+                       cache_directory.empty() ? "" : cache_directory + "/fftw_wisdom");
+    // Declared after what the tasks use, so that running tasks complete before it is destroyed.
+    TaskScheduler scheduler(num_threads);
     std::unique_ptr<AudioSystem> audio = std::make_unique<AudioSystem>();
-    State state(audio.get(), fftw_mutex);
-    SpectrumState spectrum_state(fftw_mutex);
+    ResourceManager resources(memory_budget, gpu_memory_budget);
+    // Files that are added or modified by other threads wake up the main loop.
+    const Uint32 wake_up_event = SDL_RegisterEvents(1);
+    State state(audio.get(), analysis_cache, fft_plans, scheduler, resources, decode_threads,
+                [wake_up_event] {
+                    SDL_Event event{};
+                    event.type = wake_up_event;
+                    SDL_PushEvent(&event);
+                });
+    SpectrumState spectrum_state(fft_plans);
     for (int i = optind; i < argc; i++) {
         state.LoadFile(argv[i]);
     }
@@ -140,15 +227,31 @@ int main(int argc, char** argv) {
     bool view_spectrogram = false;
     bool view_bark_scale = false;
     bool follow_playback = false;
+    // Playback switches to the selected track when it changes with the keyboard.
+    bool ab_switching = false;
 
     int win_width = 1;
 
     state.StartMonitoringTrackChange();
 
+    // Frames are only drawn when something changes: on input, during playback, while resources
+    // are loaded, and when spectra are computed.
+    bool animating = true;
+    int frames_since_input = 0;
+
     bool run = true;
     while (run) {
         SDL_Event event;
-        while (SDL_PollEvent(&event)) {
+        bool have_event = false;
+        if (animating || frames_since_input < kFramesAfterInput) {
+            have_event = SDL_PollEvent(&event);
+        } else {
+            have_event = SDL_WaitEventTimeout(&event, kPollIntervalMs);
+            if (!have_event && !scheduler.QueueDepth())
+                continue;
+        }
+        frames_since_input = have_event ? 0 : frames_since_input + 1;
+        for (; have_event; have_event = SDL_PollEvent(&event)) {
             ImGui_ImplSDL3_ProcessEvent(&event);
             switch (event.type) {
 	    case SDL_EVENT_QUIT:
@@ -180,8 +283,8 @@ int main(int argc, char** argv) {
 
                         if (mouse_down) {
                             ZoomWindow& z = state.zoom_window;
-                            const float time = z.GetTime(mouse_x);
-                            const float dt = std::fabs(time - state.Cursor());
+                            const double time = z.GetTime(mouse_x);
+                            const double dt = std::fabs(time - state.Cursor());
                             // Mouse needs to move at least one pixel to count as an interval
                             // selection.
                             if (dt >= (z.Right() - z.Left()) / io.DisplaySize.x) {
@@ -198,7 +301,7 @@ int main(int argc, char** argv) {
                         if (event.button.button == SDL_BUTTON_LEFT) {
                             if (event.button.clicks == 1) {
                                 mouse_down = true;
-                                const float time = state.zoom_window.GetTime(mouse_x);
+                                const double time = state.zoom_window.GetTime(mouse_x);
                                 state.SetCursor(time);
                             } else if (event.button.clicks == 2) {
                                 if (state.SelectedTrack() &&
@@ -280,6 +383,11 @@ int main(int argc, char** argv) {
                         follow_playback = !follow_playback;
                     }
 
+                    // A/B switching of playback between tracks.
+                    if (key == SDLK_A && !ctrl) {
+                        ab_switching = !ab_switching;
+                    }
+
                     // Zoom to selection.
                     if (key == SDLK_E && ctrl && state.Selection()) {
                         state.zoom_window.ZoomRange(state.Cursor(), *state.Selection());
@@ -363,6 +471,9 @@ int main(int argc, char** argv) {
                     // Scroll one track up.
                     if (key == SDLK_UP && !shift && !ctrl) {
                         state.ScrollTrackUp();
+                        if (ab_switching) {
+                            state.SwitchPlayback();
+                        }
                     }
 
                     // Move track down.
@@ -378,6 +489,9 @@ int main(int argc, char** argv) {
                     // Scroll one track down.
                     if (key == SDLK_DOWN && !shift && !ctrl) {
                         state.ScrollTrackDown();
+                        if (ab_switching) {
+                            state.SwitchPlayback();
+                        }
                     }
 
                     // Toggle spectrogram view.
@@ -389,10 +503,8 @@ int main(int argc, char** argv) {
                     if (key == SDLK_S) {
                         if (ctrl) {
                             const Track& selected_track = state.GetSelectedTrack();
-                            float begin = 0.0f;
-                            float end =
-                                static_cast<float>(selected_track.audio_buffer->NumFrames()) /
-                                static_cast<float>(selected_track.GetSamplerate());
+                            double begin = 0.0;
+                            double end = selected_track.audio_buffer->Duration();
                             if (state.Selection()) {
                                 state.FixSelection();
                                 begin = state.Cursor();
@@ -413,6 +525,37 @@ int main(int argc, char** argv) {
                         }
                     }
 
+                    // Spectrogram FFT size, keeping the overlap.
+                    if (key == SDLK_LEFTBRACKET || key == SDLK_RIGHTBRACKET) {
+                        SpectrogramSettings settings = state.GetSpectrogramSettings();
+                        const int overlap = settings.fft_size / settings.hop;
+                        if (key == SDLK_RIGHTBRACKET) {
+                            settings.fft_size =
+                                std::min(GpuSpectrogram::MaxFftSize(), 2 * settings.fft_size);
+                        } else {
+                            settings.fft_size = std::max(SpectrogramSettings::kMinFftSize,
+                                                         settings.fft_size / 2);
+                        }
+                        settings.hop = settings.fft_size / overlap;
+                        state.SetSpectrogramSettings(settings);
+                    }
+
+                    // Spectrogram overlap: 50%, 75% or 87.5%.
+                    if (key == SDLK_O) {
+                        SpectrogramSettings settings = state.GetSpectrogramSettings();
+                        const int overlap = settings.fft_size / settings.hop;
+                        settings.hop = settings.fft_size / (overlap >= 8 ? 2 : 2 * overlap);
+                        state.SetSpectrogramSettings(settings);
+                    }
+
+                    // Spectrogram window function.
+                    if (key == SDLK_W && !ctrl) {
+                        SpectrogramSettings settings = state.GetSpectrogramSettings();
+                        settings.window = static_cast<WindowFunction>((settings.window + 1) %
+                                                                      NUM_WINDOW_FUNCTIONS);
+                        state.SetSpectrogramSettings(settings);
+                    }
+
                     // Toggle bark scale spectrograms.
                     if (key == SDLK_B) {
                         view_bark_scale = !view_bark_scale;
@@ -421,7 +564,7 @@ int main(int argc, char** argv) {
                     // Toggle playback.
                     if (key == SDLK_SPACE) {
                         state.SetLooping(shift);
-                        float current_play_timecode = 0;
+                        double current_play_timecode = 0;
                         if (!state.Selection().has_value() &&
                             state.Playing(&current_play_timecode) && ctrl) {
                             state.SetCursor(current_play_timecode);
@@ -429,6 +572,28 @@ int main(int argc, char** argv) {
                         state.TogglePlayback();
                     }
 
+                    // Toggle playback of all tracks mixed.
+                    if (key == SDLK_P) {
+                        state.SetLooping(shift);
+                        state.TogglePlaybackOfAll();
+                    }
+
+                    // Mute or solo the selected track in the mix.
+                    if (key == SDLK_M && !shift) {
+                        state.ToggleMute();
+                    }
+                    if (key == SDLK_M && shift) {
+                        state.ToggleSolo();
+                    }
+
+                    // Gain and output channel of the selected track.
+                    if (key == SDLK_G) {
+                        state.ChangeGain(shift ? -1.f : 1.f);
+                    }
+                    if (key == SDLK_R && !ctrl) {
+                        state.CycleOutputChannel();
+                    }
+
                     // Close selected track.
                     if (key == SDLK_W && ctrl && !shift) {
                         state.UnloadSelectedTrack();
@@ -454,7 +619,7 @@ int main(int argc, char** argv) {
             }
         }
 
-        float play_time;
+        double play_time;
         bool playing = state.Playing(&play_time);
         if (playing) {
             play_time -= audio->OutputLatencyMs() / 1000.0;
@@ -490,14 +655,18 @@ int main(int argc, char** argv) {
             float slider_width = ImGui::GetWindowWidth() - 2.0f * style.WindowPadding.x;
             ImGui::PushItemWidth(slider_width);
             const float orig_min_grab_size = style.GrabMinSize;
-            style.GrabMinSize =
-                std::max(slider_width * (state.zoom_window.Right() - state.zoom_window.Left()) /
-                             (state.zoom_window.MaxX() + 1e-6f),
-                         orig_min_grab_size);
-            ImGui::SliderFloat("##Time", &scroll_value, 0.0f, scroll_max, "");
+            style.GrabMinSize = std::max(
+                static_cast<float>(slider_width *
+                                   (state.zoom_window.Right() - state.zoom_window.Left()) /
+                                   (state.zoom_window.MaxX() + 1e-6)),
+                orig_min_grab_size);
+            // Double precision slider, a float would quantize the view position in long files.
+            const double scroll_min = 0.0;
+            ImGui::SliderScalar("##Time", ImGuiDataType_Double, &scroll_value, &scroll_min,
+                                &scroll_max, "");
             style.GrabMinSize = orig_min_grab_size;
             ImGui::PopItemWidth();
-            scroll_value = std::max(0.0f, std::min(scroll_max, scroll_value));
+            scroll_value = std::max(0.0, std::min(scroll_max, scroll_value));
             state.zoom_window.PanTo(scroll_value);
             if (ImGui::BeginTable("status_table", 3, ImGuiTableFlags_SizingFixedFit)) {
                 ImGui::TableNextRow();
@@ -511,26 +680,32 @@ int main(int argc, char** argv) {
                     const Time cursor(state.Cursor());
                     ImGui::Text("%02.f:%06.03f", cursor.min, cursor.sec);
                 } else {
-                    float selection_start_time = state.Cursor();
-                    float selection_end_time = *state.Selection();
+                    double selection_start_time = state.Cursor();
+                    double selection_end_time = *state.Selection();
                     if (selection_start_time > selection_end_time)
                         std::swap(selection_start_time, selection_end_time);
                     const Time selection_start(selection_start_time);
                     const Time selection_end(selection_end_time);
-                    const float selection_length_time = selection_end_time - selection_start_time;
+                    const double selection_length_time = selection_end_time - selection_start_time;
                     const Time selection_length(selection_length_time);
                     const int samplerate = state.SelectedTrack() ? state.GetCurrentSamplerate() : 0;
-                    const int samples = static_cast<int>(selection_length_time * samplerate);
-                    const float frequency =
-                        (selection_length_time > 1e-5f && selection_length_time < 10.0f)
-                            ? 1.0f / selection_length_time
-                            : 0.0f;
+                    const long long samples = selection_length_time * samplerate;
+                    const double frequency =
+                        (selection_length_time > 1e-5 && selection_length_time < 10.0)
+                            ? 1.0 / selection_length_time
+                            : 0.0;
                     ImGui::Text(
-                        "%02.f:%06.03f - %02.f:%06.03f  Length %02.f:%06.03f  %d samples  %.03f Hz",
+                        "%02.f:%06.03f - %02.f:%06.03f  Length %02.f:%06.03f  %lld samples  "
+                        "%.03f Hz",
                         selection_start.min, selection_start.sec, selection_end.min,
                         selection_end.sec, selection_length.min, selection_length.sec, samples,
                         frequency);
                 }
+                // Loading and analysis tasks, queued or running.
+                ImGui::TableNextColumn();
+                if (const int queue_depth = scheduler.QueueDepth()) {
+                    ImGui::Text("  Tasks %d", queue_depth);
+                }
 
                 ImGui::TableNextRow();
                 ImGui::TableNextColumn();
@@ -562,9 +737,13 @@ int main(int argc, char** argv) {
                                 } else {
                                     f = y * nyquist_freq;
                                 }
-                                ImGui::Text("%02.f:%06.03f  Frequency %.0f Hz  Gain %.1f dB",
-                                            pointer.min, pointer.sec, std::round(f),
-                                            display_gain_db);
+                                const SpectrogramSettings& settings =
+                                    state.GetSpectrogramSettings();
+                                ImGui::Text(
+                                    "%02.f:%06.03f  Frequency %.0f Hz  Gain %.1f dB  FFT %d  "
+                                    "Hop %d  %s",
+                                    pointer.min, pointer.sec, std::round(f), display_gain_db,
+                                    settings.fft_size, settings.hop, settings.WindowName());
                             } else {
                                 float a = 0;
                                 if (z.DbVerticalScale()) {
@@ -579,6 +758,12 @@ int main(int argc, char** argv) {
                         }
                     }
                 }
+                // Memory of all tracks, and the budgets that least recently viewed tracks are
+                // evicted to stay within.
+                ImGui::TableNextColumn();
+                ImGui::Text("  Memory %zu/%zu MB  GPU %zu/%zu MB", resources.CpuUsage() >> 20,
+                            resources.CpuBudget() >> 20, resources.GpuUsage() >> 20,
+                            resources.GpuBudget() >> 20);
                 ImGui::EndTable();
             }
             ImGui::End();
@@ -630,7 +815,9 @@ int main(int argc, char** argv) {
 
         spectrum_window.Draw();
 
-        state.CreateResources();
+        const bool resources_to_load = state.CreateResources();
+        animating = playing || resources_to_load ||
+                    (spectrum_window.visible() && spectrum_state.Pending());
 
         // ImGui::ShowDemoWindow();
 
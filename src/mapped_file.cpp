@@ -0,0 +1,53 @@
+#include "mapped_file.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+namespace {
+// Expand [offset, offset + length) to whole pages, clamped to the mapping.
+void PageRange(size_t offset,
+               size_t length,
+               size_t size,
+               size_t* page_offset,
+               size_t* page_length) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    const size_t end = std::min(offset + length, size);
+    *page_offset = offset / page_size * page_size;
+    *page_length = end > *page_offset ? end - *page_offset : 0;
+}
+}  // namespace
+
+std::unique_ptr<MappedFile> MappedFile::Open(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) != 0 || statbuf.st_size <= 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    const size_t size = statbuf.st_size;
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps its own reference to the file.
+    close(fd);
+    if (data == MAP_FAILED)
+        return nullptr;
+
+    return std::unique_ptr<MappedFile>(new MappedFile(static_cast<const uint8_t*>(data), size));
+}
+
+MappedFile::~MappedFile() {
+    munmap(const_cast<uint8_t*>(data), size);
+}
+
+void MappedFile::Release(size_t offset, size_t length) const {
+    size_t page_offset, page_length;
+    PageRange(offset, length, size, &page_offset, &page_length);
+    if (page_length)
+        madvise(const_cast<uint8_t*>(data) + page_offset, page_length, MADV_DONTNEED);
+}
@@ -0,0 +1,29 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Read-only memory mapping of a whole file. Pages are brought in by the kernel on first access, so
+// the resident size only grows with the parts of the file that are actually touched.
+class MappedFile {
+   public:
+    // Returns nullptr if the file can not be opened or mapped.
+    static std::unique_ptr<MappedFile> Open(const std::string& path);
+    ~MappedFile();
+
+    const uint8_t* Data() const { return data; }
+    size_t Size() const { return size; }
+
+    // Drop a range from the page cache of this process. It is re-read from disk if touched again.
+    void Release(size_t offset, size_t length) const;
+
+   private:
+    MappedFile(const uint8_t* data, size_t size) : data(data), size(size) {}
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+};
+
+#endif
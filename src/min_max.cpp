@@ -0,0 +1,200 @@
+#include "min_max.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#include "cpu_features.hpp"
+
+#if defined(__SSE2__) || defined(HAVE_AVX2_KERNELS)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+#if defined(HAVE_AVX2_KERNELS)
+struct Avx2Ops {
+    // A plain array rather than a __m256, which callers that are not compiled for AVX pass
+    // differently, as the kernel templates are at -O0. Once inlined, it stays in a register.
+    struct Vector {
+        float v[8];
+    };
+    static constexpr int kWidth = 8;
+    AVX2_OPS static __m256 From(const Vector& a) { return _mm256_loadu_ps(a.v); }
+    AVX2_OPS static Vector To(__m256 x) {
+        Vector a;
+        _mm256_storeu_ps(a.v, x);
+        return a;
+    }
+    AVX2_OPS static Vector Load(const float* p) { return To(_mm256_loadu_ps(p)); }
+    AVX2_OPS static void Store(float* p, Vector v) { _mm256_storeu_ps(p, From(v)); }
+    AVX2_OPS static Vector Min(Vector a, Vector b) { return To(_mm256_min_ps(From(a), From(b))); }
+    AVX2_OPS static Vector Max(Vector a, Vector b) { return To(_mm256_max_ps(From(a), From(b))); }
+};
+#endif
+
+#if defined(__SSE2__)
+struct Simd4Ops {
+    using Vector = __m128;
+    static constexpr int kWidth = 4;
+    static Vector Load(const float* p) { return _mm_loadu_ps(p); }
+    static void Store(float* p, Vector v) { _mm_storeu_ps(p, v); }
+    static Vector Min(Vector a, Vector b) { return _mm_min_ps(a, b); }
+    static Vector Max(Vector a, Vector b) { return _mm_max_ps(a, b); }
+};
+#elif defined(__ARM_NEON)
+struct Simd4Ops {
+    using Vector = float32x4_t;
+    static constexpr int kWidth = 4;
+    static Vector Load(const float* p) { return vld1q_f32(p); }
+    static void Store(float* p, Vector v) { vst1q_f32(p, v); }
+    static Vector Min(Vector a, Vector b) { return vminq_f32(a, b); }
+    static Vector Max(Vector a, Vector b) { return vmaxq_f32(a, b); }
+};
+#endif
+
+void MinMaxScalar(const float* samples, int num_channels, int num_frames, float* min, float* max) {
+    std::fill(min, min + num_channels, std::numeric_limits<float>::max());
+    std::fill(max, max + num_channels, std::numeric_limits<float>::lowest());
+    for (int n = 0; n < num_frames; n++) {
+        for (int c = 0; c < num_channels; c++) {
+            min[c] = std::min(min[c], samples[n * num_channels + c]);
+            max[c] = std::max(max[c], samples[n * num_channels + c]);
+        }
+    }
+}
+
+// For kWidth % num_channels == 0: every vector holds whole frames, so a lane always maps to the
+// same channel and the block can be reduced as one flat array.
+template <class Ops>
+void MinMaxLanes(const float* samples, int num_channels, int num_frames, float* min, float* max) {
+    constexpr int kWidth = Ops::kWidth;
+    const int num_samples = num_frames * num_channels;
+    const int num_vector_samples = num_samples - num_samples % kWidth;
+    if (!num_vector_samples) {
+        MinMaxScalar(samples, num_channels, num_frames, min, max);
+        return;
+    }
+
+    typename Ops::Vector vmin = Ops::Load(samples);
+    typename Ops::Vector vmax = vmin;
+    for (int i = kWidth; i < num_vector_samples; i += kWidth) {
+        const typename Ops::Vector v = Ops::Load(samples + i);
+        vmin = Ops::Min(vmin, v);
+        vmax = Ops::Max(vmax, v);
+    }
+
+    // Fold the lanes into channels.
+    float lanes_min[kWidth];
+    float lanes_max[kWidth];
+    Ops::Store(lanes_min, vmin);
+    Ops::Store(lanes_max, vmax);
+    std::copy(lanes_min, lanes_min + num_channels, min);
+    std::copy(lanes_max, lanes_max + num_channels, max);
+    for (int k = num_channels; k < kWidth; k++) {
+        min[k % num_channels] = std::min(min[k % num_channels], lanes_min[k]);
+        max[k % num_channels] = std::max(max[k % num_channels], lanes_max[k]);
+    }
+    for (int i = num_vector_samples; i < num_samples; i++) {
+        min[i % num_channels] = std::min(min[i % num_channels], samples[i]);
+        max[i % num_channels] = std::max(max[i % num_channels], samples[i]);
+    }
+}
+
+// For num_channels >= kWidth: vectorize across the channels of each frame.
+template <class Ops>
+void MinMaxRows(const float* samples, int num_channels, int num_frames, float* min, float* max) {
+    constexpr int kWidth = Ops::kWidth;
+    if (!num_frames) {
+        MinMaxScalar(samples, num_channels, num_frames, min, max);
+        return;
+    }
+
+    const int num_vector_channels = num_channels - num_channels % kWidth;
+    std::copy(samples, samples + num_channels, min);
+    std::copy(samples, samples + num_channels, max);
+    for (int n = 1; n < num_frames; n++) {
+        const float* frame = samples + n * num_channels;
+        for (int c = 0; c < num_vector_channels; c += kWidth) {
+            const typename Ops::Vector v = Ops::Load(frame + c);
+            Ops::Store(min + c, Ops::Min(Ops::Load(min + c), v));
+            Ops::Store(max + c, Ops::Max(Ops::Load(max + c), v));
+        }
+        for (int c = num_vector_channels; c < num_channels; c++) {
+            min[c] = std::min(min[c], frame[c]);
+            max[c] = std::max(max[c], frame[c]);
+        }
+    }
+}
+
+using BlockFunction = void (*)(const float*, int, int, float*, float*);
+using BlocksFunction = void (*)(const float*, int, int64_t, int, float*);
+
+template <BlockFunction f>
+void ForEachBlock(const float* samples,
+                  int num_channels,
+                  int64_t num_frames,
+                  int block_frames,
+                  float* dest) {
+    for (int64_t i = 0; i < num_frames; i += block_frames) {
+        const int frames = std::min<int64_t>(block_frames, num_frames - i);
+        f(samples + i * num_channels, num_channels, frames, dest, dest + num_channels);
+        dest += 2 * num_channels;
+    }
+}
+
+template <class Ops>
+BlocksFunction SelectSimd(int num_channels) {
+    if (num_channels >= Ops::kWidth)
+        return ForEachBlock<MinMaxRows<Ops>>;
+    if (Ops::kWidth % num_channels == 0)
+        return ForEachBlock<MinMaxLanes<Ops>>;
+    return nullptr;
+}
+
+#if defined(HAVE_AVX2_KERNELS)
+AVX2_KERNEL void MinMaxRowsAvx2(const float* samples,
+                                int num_channels,
+                                int64_t num_frames,
+                                int block_frames,
+                                float* dest) {
+    ForEachBlock<MinMaxRows<Avx2Ops>>(samples, num_channels, num_frames, block_frames, dest);
+}
+
+// Only for whole vectors of channels: with fewer channels, folding the 8 lanes of each block costs
+// more than the wider vectors save, and the 4-wide kernel is faster.
+BlocksFunction SelectAvx2(int num_channels) {
+    if (kCpuHasAvx2 && num_channels >= Avx2Ops::kWidth)
+        return MinMaxRowsAvx2;
+    return nullptr;
+}
+#endif
+}  // namespace
+
+void MinMaxBlocks(const float* samples,
+                  int num_channels,
+                  int64_t num_frames,
+                  int block_frames,
+                  float* dest) {
+    BlocksFunction f = nullptr;
+#if defined(HAVE_AVX2_KERNELS)
+    f = SelectAvx2(num_channels);
+#endif
+#if defined(__SSE2__) || defined(__ARM_NEON)
+    if (!f) {
+        f = SelectSimd<Simd4Ops>(num_channels);
+    }
+#endif
+    if (!f) {
+        f = ForEachBlock<MinMaxScalar>;
+    }
+    f(samples, num_channels, num_frames, block_frames, dest);
+}
+
+void MinMaxBlocksScalar(const float* samples,
+                        int num_channels,
+                        int64_t num_frames,
+                        int block_frames,
+                        float* dest) {
+    ForEachBlock<MinMaxScalar>(samples, num_channels, num_frames, block_frames, dest);
+}
@@ -0,0 +1,23 @@
+#ifndef MIN_MAX_HPP
+#define MIN_MAX_HPP
+
+#include <cstdint>
+
+// Minimum and maximum per channel for consecutive blocks of |block_frames| interleaved frames (the
+// last block may be shorter). For every block, |num_channels| minimums followed by |num_channels|
+// maximums are written to |dest|. Uses SIMD (SSE2 or NEON depending on the build target, and AVX2
+// from 8 channels if the CPU has it) for the common channel layouts and a scalar loop otherwise.
+void MinMaxBlocks(const float* samples,
+                  int num_channels,
+                  int64_t num_frames,
+                  int block_frames,
+                  float* dest);
+
+// Scalar reference implementation of MinMaxBlocks.
+void MinMaxBlocksScalar(const float* samples,
+                        int num_channels,
+                        int64_t num_frames,
+                        int block_frames,
+                        float* dest);
+
+#endif
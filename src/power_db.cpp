@@ -0,0 +1,200 @@
+#include "power_db.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "cpu_features.hpp"
+
+#if defined(__SSE2__) || defined(HAVE_AVX2_KERNELS)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+constexpr float kScaling = 65535.f / (kPowerDbMax - kPowerDbMin);
+// Powers below this are clamped anyway. Clamping before the logarithm also avoids zeros and
+// denormals in the approximation.
+constexpr float kMinPower = 1e-10f;
+// 10 * log10(2), for dB from log2.
+constexpr float kDbPerOctave = 3.01029996f;
+
+// Least squares fit of log2(1 + x) for x in [0, 1), max error 1.5e-5 (0.04 quantization steps).
+constexpr float kLog2Poly[] = {1.43541059e-05f, 1.44159271f, -0.707256362f,
+                               0.411566809f,    -0.189836406f, 0.0439295708f};
+
+#if defined(HAVE_AVX2_KERNELS)
+struct Avx2Ops {
+    // A plain array rather than a __m256, which callers that are not compiled for AVX pass
+    // differently, as PowerToDb16Simd is at -O0. Once inlined, it stays in a register.
+    struct Vector {
+        float v[8];
+    };
+    static constexpr int kWidth = 8;
+    AVX2_OPS static __m256 From(const Vector& a) { return _mm256_loadu_ps(a.v); }
+    AVX2_OPS static Vector To(__m256 x) {
+        Vector a;
+        _mm256_storeu_ps(a.v, x);
+        return a;
+    }
+    AVX2_OPS static Vector Set(float x) { return To(_mm256_set1_ps(x)); }
+    AVX2_OPS static Vector Add(Vector a, Vector b) { return To(_mm256_add_ps(From(a), From(b))); }
+    AVX2_OPS static Vector Mul(Vector a, Vector b) { return To(_mm256_mul_ps(From(a), From(b))); }
+    AVX2_OPS static Vector Min(Vector a, Vector b) { return To(_mm256_min_ps(From(a), From(b))); }
+    AVX2_OPS static Vector Max(Vector a, Vector b) { return To(_mm256_max_ps(From(a), From(b))); }
+    // re^2 + im^2 of kWidth interleaved complex values.
+    AVX2_OPS static Vector Power(const float* p) {
+        const __m256 a = _mm256_loadu_ps(p);
+        const __m256 b = _mm256_loadu_ps(p + kWidth);
+        const __m256 a2 = _mm256_mul_ps(a, a);
+        const __m256 b2 = _mm256_mul_ps(b, b);
+        // Shuffles work within 128-bit lanes, which leaves the bins in order 0 1 4 5 2 3 6 7.
+        const __m256 power = _mm256_add_ps(_mm256_shuffle_ps(a2, b2, _MM_SHUFFLE(2, 0, 2, 0)),
+                                           _mm256_shuffle_ps(a2, b2, _MM_SHUFFLE(3, 1, 3, 1)));
+        return To(_mm256_castpd_ps(
+            _mm256_permute4x64_pd(_mm256_castps_pd(power), _MM_SHUFFLE(3, 1, 2, 0))));
+    }
+    // Split positive |x| into exponent and mantissa in [1, 2).
+    AVX2_OPS static Vector Exponent(Vector x, Vector* mantissa) {
+        const __m256i bits = _mm256_castps_si256(From(x));
+        *mantissa = To(_mm256_castsi256_ps(_mm256_or_si256(
+            _mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)), _mm256_set1_epi32(0x3f800000))));
+        return To(_mm256_cvtepi32_ps(
+            _mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127))));
+    }
+    // Truncate values in [0, 65535] to 16 bits.
+    AVX2_OPS static void Store(uint16_t* p, Vector v) {
+        const __m256i x = _mm256_cvttps_epi32(From(v));
+        const __m256i packed =
+            _mm256_permute4x64_epi64(_mm256_packus_epi32(x, x), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm256_castsi256_si128(packed));
+    }
+};
+#endif
+
+#if defined(__SSE2__)
+struct Simd4Ops {
+    using Vector = __m128;
+    static constexpr int kWidth = 4;
+    static Vector Set(float x) { return _mm_set1_ps(x); }
+    static Vector Add(Vector a, Vector b) { return _mm_add_ps(a, b); }
+    static Vector Mul(Vector a, Vector b) { return _mm_mul_ps(a, b); }
+    static Vector Min(Vector a, Vector b) { return _mm_min_ps(a, b); }
+    static Vector Max(Vector a, Vector b) { return _mm_max_ps(a, b); }
+    static Vector Power(const float* p) {
+        const Vector a = _mm_loadu_ps(p);
+        const Vector b = _mm_loadu_ps(p + kWidth);
+        const Vector a2 = _mm_mul_ps(a, a);
+        const Vector b2 = _mm_mul_ps(b, b);
+        return _mm_add_ps(_mm_shuffle_ps(a2, b2, _MM_SHUFFLE(2, 0, 2, 0)),
+                          _mm_shuffle_ps(a2, b2, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+    static Vector Exponent(Vector x, Vector* mantissa) {
+        const __m128i bits = _mm_castps_si128(x);
+        *mantissa = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)),
+                                                  _mm_set1_epi32(0x3f800000)));
+        return _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+    }
+    static void Store(uint16_t* p, Vector v) {
+        // SSE2 only has a signed 32 to 16 bit pack, so offset the values into the signed range.
+        const __m128i x = _mm_sub_epi32(_mm_cvttps_epi32(v), _mm_set1_epi32(32768));
+        const __m128i packed = _mm_xor_si128(_mm_packs_epi32(x, x), _mm_set1_epi16(-32768));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(p), packed);
+    }
+};
+#elif defined(__ARM_NEON)
+struct Simd4Ops {
+    using Vector = float32x4_t;
+    static constexpr int kWidth = 4;
+    static Vector Set(float x) { return vdupq_n_f32(x); }
+    static Vector Add(Vector a, Vector b) { return vaddq_f32(a, b); }
+    static Vector Mul(Vector a, Vector b) { return vmulq_f32(a, b); }
+    static Vector Min(Vector a, Vector b) { return vminq_f32(a, b); }
+    static Vector Max(Vector a, Vector b) { return vmaxq_f32(a, b); }
+    static Vector Power(const float* p) {
+        const float32x4x2_t v = vld2q_f32(p);
+        return vmlaq_f32(vmulq_f32(v.val[0], v.val[0]), v.val[1], v.val[1]);
+    }
+    static Vector Exponent(Vector x, Vector* mantissa) {
+        const uint32x4_t bits = vreinterpretq_u32_f32(x);
+        *mantissa = vreinterpretq_f32_u32(
+            vorrq_u32(vandq_u32(bits, vdupq_n_u32(0x007fffff)), vdupq_n_u32(0x3f800000)));
+        return vcvtq_f32_s32(
+            vsubq_s32(vreinterpretq_s32_u32(vshrq_n_u32(bits, 23)), vdupq_n_s32(127)));
+    }
+    static void Store(uint16_t* p, Vector v) { vst1_u16(p, vmovn_u32(vcvtq_u32_f32(v))); }
+};
+#endif
+
+template <class Ops>
+void PowerToDb16Simd(const float* spectrum, int num_bins, float scale, uint16_t* dest) {
+    using Vector = typename Ops::Vector;
+    constexpr int kWidth = Ops::kWidth;
+    const Vector scale2 = Ops::Set(scale * scale);
+    const Vector min_power = Ops::Set(kMinPower);
+    // Quantized value from log2 of the power.
+    const Vector gain = Ops::Set(kDbPerOctave * kScaling);
+    const Vector offset = Ops::Set(-kPowerDbMin * kScaling);
+    const Vector zero = Ops::Set(0.f);
+    const Vector max = Ops::Set(65535.f);
+
+    auto convert = [&](const float* in, uint16_t* out) {
+        const Vector power = Ops::Max(Ops::Mul(Ops::Power(in), scale2), min_power);
+        Vector mantissa;
+        const Vector exponent = Ops::Exponent(power, &mantissa);
+        const Vector x = Ops::Add(mantissa, Ops::Set(-1.f));
+        Vector log2 = Ops::Set(kLog2Poly[5]);
+        for (int k = 4; k >= 0; k--) {
+            log2 = Ops::Add(Ops::Mul(log2, x), Ops::Set(kLog2Poly[k]));
+        }
+        log2 = Ops::Add(log2, exponent);
+        const Vector q = Ops::Add(Ops::Mul(log2, gain), offset);
+        Ops::Store(out, Ops::Min(Ops::Max(q, zero), max));
+    };
+
+    const int num_vector_bins = num_bins - num_bins % kWidth;
+    for (int i = 0; i < num_vector_bins; i += kWidth) {
+        convert(spectrum + 2 * i, dest + i);
+    }
+
+    // Run the remaining bins through the same approximation, padded with zeros.
+    const int remaining = num_bins - num_vector_bins;
+    if (remaining) {
+        float in[2 * kWidth] = {};
+        uint16_t out[kWidth];
+        std::copy(spectrum + 2 * num_vector_bins, spectrum + 2 * num_bins, in);
+        convert(in, out);
+        std::copy(out, out + remaining, dest + num_vector_bins);
+    }
+}
+
+#if defined(HAVE_AVX2_KERNELS)
+AVX2_KERNEL void PowerToDb16Avx2(const float* spectrum, int num_bins, float scale, uint16_t* dest) {
+    PowerToDb16Simd<Avx2Ops>(spectrum, num_bins, scale, dest);
+}
+#endif
+}  // namespace
+
+void PowerToDb16(const float* spectrum, int num_bins, float scale, uint16_t* dest) {
+#if defined(HAVE_AVX2_KERNELS)
+    if (kCpuHasAvx2) {
+        PowerToDb16Avx2(spectrum, num_bins, scale, dest);
+        return;
+    }
+#endif
+#if defined(__SSE2__) || defined(__ARM_NEON)
+    PowerToDb16Simd<Simd4Ops>(spectrum, num_bins, scale, dest);
+#else
+    PowerToDb16Scalar(spectrum, num_bins, scale, dest);
+#endif
+}
+
+void PowerToDb16Scalar(const float* spectrum, int num_bins, float scale, uint16_t* dest) {
+    for (int k = 0; k < num_bins; k++) {
+        const float re = spectrum[2 * k] * scale;
+        const float im = spectrum[2 * k + 1] * scale;
+        const float dB =
+            std::max(kPowerDbMin, std::min(kPowerDbMax, 10.f * std::log10(re * re + im * im)));
+        dest[k] = (dB - kPowerDbMin) * kScaling;
+    }
+}
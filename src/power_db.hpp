@@ -0,0 +1,20 @@
+#ifndef POWER_DB_HPP
+#define POWER_DB_HPP
+
+#include <cstdint>
+
+// Range of the quantized power spectra. Powers at or below kPowerDbMin map to 0 and powers at or
+// above kPowerDbMax map to 65535.
+constexpr float kPowerDbMin = -100.f;
+constexpr float kPowerDbMax = -20.f;
+
+// Power in dB of |num_bins| complex values (interleaved real and imaginary parts) after scaling by
+// |scale|, quantized to 16 bits. Uses SIMD (AVX2 if the CPU has it, else SSE2 or NEON depending on
+// the build target) with a polynomial log2 approximation, which is within one quantization step of
+// the scalar reference.
+void PowerToDb16(const float* spectrum, int num_bins, float scale, uint16_t* dest);
+
+// Scalar reference implementation of PowerToDb16, using std::log10.
+void PowerToDb16Scalar(const float* spectrum, int num_bins, float scale, uint16_t* dest);
+
+#endif
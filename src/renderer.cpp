@@ -15,7 +15,7 @@
 #include "wave_shader.hpp"
 
 namespace {
-std::string TimeToString(float t, float dt, bool show_minutes) {
+std::string TimeToString(double t, float dt, bool show_minutes) {
     int decimals;
     if (dt < 0.01f) {
         decimals = 3;
@@ -28,10 +28,10 @@ std::string TimeToString(float t, float dt, bool show_minutes) {
     }
 
     // Convert to minutes and seconds.
-    t += 1e-4f;  // Avoid rounding errors.
-    const int minutes = std::floor(t / 60.f);
-    t -= 60.f * minutes;
-    const float seconds = t;
+    t += 1e-4;  // Avoid rounding errors.
+    const int minutes = std::floor(t / 60.0);
+    t -= 60.0 * minutes;
+    const double seconds = t;
 
     std::ostringstream str;
     if (show_minutes) {
@@ -63,7 +63,7 @@ void TimelineResolution(float view_length, float& dt_labeled, int& unlabeled_rat
     }
 }
 
-float TimelineStart(float view_start, float dt) {
+double TimelineStart(double view_start, double dt) {
     return std::floor(view_start / dt) * dt;
 }
 }  // namespace
@@ -82,7 +82,7 @@ class RendererImpl : public Renderer {
         bool view_spectrogram,
         bool view_bark_scale,
         bool playing,
-        float play_time,
+        double play_time,
         const std::function<void(float, bool selected, const char*)>& label_print_func,
         const std::function<void(float, const char*)>& time_print_func);
 
@@ -140,9 +140,11 @@ void RendererImpl::Draw(
     bool view_spectrogram,
     bool view_bark_scale,
     bool playing,
-    float play_time,
+    double play_time,
     const std::function<void(float, bool selected, const char*)>& label_print_func,
     const std::function<void(float, const char*)>& time_print_func) {
+    // Everything is drawn relative to the left edge of the view. Differences are taken in double
+    // precision before converting to float.
     const ZoomWindow& z = state->zoom_window;
     const float cursor_x = state->Cursor() - z.Left();
     const float view_length = z.Right() - z.Left();
@@ -165,8 +167,8 @@ void RendererImpl::Draw(
         prim_renderer.DrawLine(mvp_timeline, glm::vec2(t_view, 0.0f),
                                glm::vec2(t_view, labeled_marker ? 0.5f : 0.25f), color_timeline);
         if (labeled_marker) {
-            const float t = t_view + z.Left();
-            if (t > 0.f) {
+            const double t = TimelineStart(z.Left(), dt_labeled) + i * dt;
+            if (t > 0.0) {
                 std::string key = TimeToString(t, dt_labeled, show_minutes);
                 const float x = t_view / view_length * win_width;
                 time_print_func(x, key.c_str());
@@ -208,7 +210,30 @@ void RendererImpl::Draw(
 
         const int num_channels = t.selected_channel ? 1 : t.audio_buffer->NumChannels();
         const int samplerate = t.audio_buffer->Samplerate();
-        const float length = t.audio_buffer->Duration();
+        const double length = t.audio_buffer->Duration();
+        // Progress is shown in the label while the file is being loaded, followed by the state of
+        // the track in the mix.
+        std::string suffix;
+        if (!t.audio_buffer->Loaded() && t.audio_buffer->NumFrames()) {
+            suffix = " - loading " +
+                      std::to_string(100 * t.audio_buffer->LoadedFrames() /
+                                     t.audio_buffer->NumFrames()) +
+                      "%";
+        }
+        if (t.muted) {
+            suffix += " - muted";
+        } else if (t.soloed) {
+            suffix += " - solo";
+        }
+        if (t.gain_db != 0.f) {
+            std::ostringstream gain;
+            gain.precision(1);
+            gain << " - " << std::showpos << std::fixed << t.gain_db << " dB";
+            suffix += gain.str();
+        }
+        if (t.output_channel) {
+            suffix += " - output " + std::to_string(*t.output_channel + 1);
+        }
 
         for (int c = 0; c < num_channels; c++) {
             const float trackOffset = i;
@@ -224,26 +249,47 @@ void RendererImpl::Draw(
                                    glm::vec2(length - z.Left(), 0.f), color_line);
             if (view_spectrogram) {
                 if (t.gpu_spectrogram) {
-                    spectrogram_shader.Draw(mvp_channel, z.Left(), samplerate, view_bark_scale,
+                    spectrogram_shader.Draw(mvp_channel, samplerate, view_bark_scale,
                                             z.VerticalZoom());
-                    t.gpu_spectrogram->Draw(channel_index);
+                    for (int tile = 0; tile < t.gpu_spectrogram->NumTiles(); tile++) {
+                        if (!t.gpu_spectrogram->HasTile(tile) ||
+                            t.gpu_spectrogram->TileEndTime(tile) < z.Left() ||
+                            t.gpu_spectrogram->TileStartTime(tile) > z.Right()) {
+                            continue;
+                        }
+                        spectrogram_shader.SetStartTime(z.Left() -
+                                                        t.gpu_spectrogram->TileStartTime(tile));
+                        t.gpu_spectrogram->DrawTile(channel_index, tile);
+                    }
                 }
             } else {
                 if (t.gpu_waveform) {
                     float samples_per_pixel = (z.Right() - z.Left()) * samplerate / win_width;
-                    const bool draw_low_res = samples_per_pixel > 1000.f;
+                    // Pick the pyramid level so that each vertex covers about one pixel.
+                    const int level = t.gpu_waveform->Level(samples_per_pixel);
                     const bool draw_discrete_samples = samples_per_pixel < 0.25f;
-                    const float rate = draw_low_res ? samplerate * 2.f / 1000.f : samplerate;
+                    const float rate = t.gpu_waveform->Rate(level);
+                    // Vertices are drawn in runs, each positioned relative to its first vertex.
+                    auto mvp_wave = [&](double first_vertex_time) {
+                        return glm::translate(
+                            mvp_channel,
+                            glm::vec3(static_cast<float>(first_vertex_time - z.Left()), 0.f, 0.f));
+                    };
                     if (draw_discrete_samples) {
-                        sample_line_shader.Draw(mvp_channel, rate, z.VerticalZoom());
-                        t.gpu_waveform->DrawPoints(channel_index, z.Left(), z.Right(),
-                                                   draw_low_res);
-                        sample_point_shader.Draw(mvp_channel, rate, z.VerticalZoom());
-                        t.gpu_waveform->DrawPoints(channel_index, z.Left(), z.Right(),
-                                                   draw_low_res);
+                        t.gpu_waveform->DrawPoints(
+                            channel_index, z.Left(), z.Right(), level, [&](double time) {
+                                sample_line_shader.Draw(mvp_wave(time), rate, z.VerticalZoom());
+                            });
+                        t.gpu_waveform->DrawPoints(
+                            channel_index, z.Left(), z.Right(), level, [&](double time) {
+                                sample_point_shader.Draw(mvp_wave(time), rate, z.VerticalZoom());
+                            });
                     } else {
-                        wave_shader.Draw(mvp_channel, rate, z.VerticalZoom(), z.DbVerticalScale());
-                        t.gpu_waveform->DrawLines(channel_index, z.Left(), z.Right(), draw_low_res);
+                        t.gpu_waveform->DrawLines(
+                            channel_index, z.Left(), z.Right(), level, [&](double time) {
+                                wave_shader.Draw(mvp_wave(time), rate, z.VerticalZoom(),
+                                                 z.DbVerticalScale());
+                            });
                     }
                 }
             }
@@ -252,7 +298,7 @@ void RendererImpl::Draw(
                 std::string label = t.short_name + " - channel " +
                                     std::to_string(*t.selected_channel + 1) + "/" +
                                     std::to_string(t.audio_buffer->NumChannels()) + " - " +
-                                    std::to_string(samplerate) + " Hz";
+                                    std::to_string(samplerate) + " Hz" + suffix;
                 label_print_func(label_y, selected_track, label.c_str());
             }
         }
@@ -266,7 +312,7 @@ void RendererImpl::Draw(
             } else {
                 label += std::to_string(num_channels) + " channels";
             }
-            label += " - " + std::to_string(samplerate) + " Hz";
+            label += " - " + std::to_string(samplerate) + " Hz" + suffix;
             label_print_func(label_y, selected_track, label.c_str());
         }
     }
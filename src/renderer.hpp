@@ -20,7 +20,7 @@ class Renderer {
         bool view_spectrogram,
         bool view_bark_scale,
         bool playing,
-        float play_time,
+        double play_time,
         const std::function<void(float, bool selected, const char*)>& label_print_func,
         const std::function<void(float, const char*)>& time_print_func) = 0;
   static std::unique_ptr<Renderer> Create();
@@ -0,0 +1,237 @@
+#include "resampler.hpp"
+#include <algorithm>
+#include <cmath>
+
+#include "cpu_features.hpp"
+
+#if defined(__SSE2__) || defined(HAVE_AVX2_KERNELS)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+// Passband edge relative to the lower of the two Nyquist frequencies.
+constexpr double kPassband = 0.95;
+constexpr double kKaiserBeta = 8.0;
+// Taps are padded to a multiple of the widest SIMD width.
+constexpr int kTapAlignment = 8;
+
+// Zeroth order modified Bessel function of the first kind.
+double BesselI0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 50 && term > 1e-12 * sum; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+#if defined(HAVE_AVX2_KERNELS)
+// Not inlined into Filter(), which is not compiled for AVX, but every call runs over all taps.
+struct Avx2Ops {
+    static constexpr int kWidth = 8;
+    AVX2_OPS static void Interpolate(const float* a,
+                                     const float* b,
+                                     float weight,
+                                     float* dest,
+                                     int n) {
+        const __m256 w = _mm256_set1_ps(weight);
+        for (int i = 0; i < n; i += kWidth) {
+            const __m256 x = _mm256_loadu_ps(a + i);
+            const __m256 y = _mm256_loadu_ps(b + i);
+            _mm256_storeu_ps(dest + i, _mm256_add_ps(x, _mm256_mul_ps(w, _mm256_sub_ps(y, x))));
+        }
+    }
+    AVX2_OPS static float Dot(const float* a, const float* b, int n) {
+        __m256 acc = _mm256_setzero_ps();
+        for (int i = 0; i < n; i += kWidth) {
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+        }
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+        return _mm_cvtss_f32(sum);
+    }
+};
+#endif
+
+#if defined(__SSE2__)
+struct Simd4Ops {
+    static constexpr int kWidth = 4;
+    static void Interpolate(const float* a, const float* b, float weight, float* dest, int n) {
+        const __m128 w = _mm_set1_ps(weight);
+        for (int i = 0; i < n; i += kWidth) {
+            const __m128 x = _mm_loadu_ps(a + i);
+            const __m128 y = _mm_loadu_ps(b + i);
+            _mm_storeu_ps(dest + i, _mm_add_ps(x, _mm_mul_ps(w, _mm_sub_ps(y, x))));
+        }
+    }
+    static float Dot(const float* a, const float* b, int n) {
+        __m128 acc = _mm_setzero_ps();
+        for (int i = 0; i < n; i += kWidth) {
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        }
+        acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+        acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+        return _mm_cvtss_f32(acc);
+    }
+};
+#elif defined(__ARM_NEON)
+struct Simd4Ops {
+    static constexpr int kWidth = 4;
+    static void Interpolate(const float* a, const float* b, float weight, float* dest, int n) {
+        for (int i = 0; i < n; i += kWidth) {
+            const float32x4_t x = vld1q_f32(a + i);
+            vst1q_f32(dest + i, vmlaq_n_f32(x, vsubq_f32(vld1q_f32(b + i), x), weight));
+        }
+    }
+    static float Dot(const float* a, const float* b, int n) {
+        float32x4_t acc = vdupq_n_f32(0.f);
+        for (int i = 0; i < n; i += kWidth) {
+            acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+        }
+        const float32x2_t sum = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+        return vget_lane_f32(vpadd_f32(sum, sum), 0);
+    }
+};
+#endif
+
+struct ScalarOps {
+    static void Interpolate(const float* a, const float* b, float weight, float* dest, int n) {
+        for (int i = 0; i < n; i++) {
+            dest[i] = a[i] + weight * (b[i] - a[i]);
+        }
+    }
+    static float Dot(const float* a, const float* b, int n) {
+        float sum = 0.f;
+        for (int i = 0; i < n; i++) {
+            sum += a[i] * b[i];
+        }
+        return sum;
+    }
+};
+
+#if defined(__SSE2__) || defined(__ARM_NEON)
+using DefaultOps = Simd4Ops;
+#else
+using DefaultOps = ScalarOps;
+#endif
+}  // namespace
+
+Resampler::Resampler(int num_channels, int input_rate, int output_rate, int max_output_frames)
+    : num_channels(num_channels), input_rate(input_rate), output_rate(output_rate) {
+    // When downsampling, the filter is widened to cut off below the output Nyquist frequency.
+    const double scale = std::min(1.0, static_cast<double>(output_rate) / input_rate);
+    const double cutoff = 0.5 * kPassband * scale;
+    half = static_cast<int>(std::ceil(kZeroCrossings / scale));
+    num_taps = (2 * half + kTapAlignment - 1) / kTapAlignment * kTapAlignment;
+
+    // Tap k of phase p is at distance p / kPhases + half - 1 - k from the output position.
+    table.resize(static_cast<size_t>(kPhases + 1) * num_taps);
+    const double window_scale = 1.0 / BesselI0(kKaiserBeta);
+    for (int p = 0; p <= kPhases; p++) {
+        float* row = &table[static_cast<size_t>(p) * num_taps];
+        double sum = 0.0;
+        for (int k = 0; k < num_taps; k++) {
+            const double t = static_cast<double>(p) / kPhases + half - 1 - k;
+            const double x = t / half;
+            double h = 0.0;
+            if (std::abs(x) < 1.0) {
+                const double arg = 2.0 * M_PI * cutoff * t;
+                const double sinc = arg == 0.0 ? 1.0 : std::sin(arg) / arg;
+                h = sinc * BesselI0(kKaiserBeta * std::sqrt(1.0 - x * x)) * window_scale;
+            }
+            row[k] = h;
+            sum += h;
+        }
+        // Unity gain at DC for every phase.
+        for (int k = 0; k < num_taps; k++) {
+            row[k] /= sum;
+        }
+    }
+
+    max_input_frames = static_cast<int64_t>(max_output_frames) * input_rate / output_rate +
+                       num_taps + 2;
+    history.resize(num_channels, std::vector<float>(num_taps + max_input_frames, 0.f));
+    coefficients.resize(num_taps);
+    Reset();
+}
+
+void Resampler::Reset() {
+    // The first output is at the first input, with zeros before it.
+    history_frames = half - 1;
+    for (std::vector<float>& h : history) {
+        std::fill(h.begin(), h.begin() + history_frames, 0.f);
+    }
+    first_tap = 0;
+    fraction = 0;
+}
+
+int64_t Resampler::InputFramesNeeded(int num_output) const {
+    if (num_output <= 0)
+        return 0;
+    const int64_t last_first_tap =
+        first_tap + (fraction + static_cast<int64_t>(num_output - 1) * input_rate) / output_rate;
+    return std::max<int64_t>(last_first_tap + num_taps - history_frames, 0);
+}
+
+void Resampler::Process(const float* input, float* output, int num_output) {
+    const int64_t num_input = InputFramesNeeded(num_output);
+    for (int c = 0; c < num_channels; c++) {
+        float* dest = &history[c][history_frames];
+        for (int64_t i = 0; i < num_input; i++) {
+            dest[i] = input[i * num_channels + c];
+        }
+    }
+    history_frames += num_input;
+
+#if defined(HAVE_AVX2_KERNELS)
+    if (kCpuHasAvx2) {
+        Filter<Avx2Ops>(output, num_output);
+    } else {
+        Filter<DefaultOps>(output, num_output);
+    }
+#else
+    Filter<DefaultOps>(output, num_output);
+#endif
+
+    // Keep the input from the first tap of the next output.
+    for (std::vector<float>& h : history) {
+        std::copy(h.begin() + first_tap, h.begin() + history_frames, h.begin());
+    }
+    history_frames -= first_tap;
+    first_tap = 0;
+}
+
+template <class Ops>
+void Resampler::Filter(float* output, int num_output) {
+    const int64_t step = input_rate / output_rate;
+    const int64_t remainder = input_rate % output_rate;
+    for (int n = 0; n < num_output; n++) {
+        // Interpolate between the two tabulated phases around the fractional position.
+        const int64_t scaled = fraction * kPhases;
+        const int phase = scaled / output_rate;
+        const float weight = static_cast<float>(scaled % output_rate) / output_rate;
+        Ops::Interpolate(&table[static_cast<size_t>(phase) * num_taps],
+                         &table[static_cast<size_t>(phase + 1) * num_taps], weight,
+                         coefficients.data(), num_taps);
+        for (int c = 0; c < num_channels; c++) {
+            output[n * num_channels + c] =
+                Ops::Dot(coefficients.data(), &history[c][first_tap], num_taps);
+        }
+
+        first_tap += step;
+        fraction += remainder;
+        if (fraction >= output_rate) {
+            fraction -= output_rate;
+            first_tap++;
+        }
+    }
+}
+
+void Resampler::SetOffset(double offset) {
+    fraction = std::llround(offset * output_rate);
+    fraction = std::max<int64_t>(std::min<int64_t>(fraction, output_rate - 1), 0);
+}
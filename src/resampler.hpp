@@ -0,0 +1,60 @@
+#ifndef RESAMPLER_HPP
+#define RESAMPLER_HPP
+
+#include <cstdint>
+#include <vector>
+
+// Streaming sample rate conversion of interleaved frames with a Kaiser-windowed sinc filter. The
+// filter is tabulated at kPhases fractional positions and interpolated linearly in between, so
+// any pair of rates works without an exact polyphase decomposition. The filter is widened when
+// downsampling, to remove what is above the output Nyquist frequency. Positions advance in exact
+// integer steps, so there is no drift in long streams. All memory is allocated by the
+// constructor, so Process() can run on the audio thread.
+class Resampler {
+   public:
+    static constexpr int kPhases = 256;
+    // Zero crossings of the filter on each side when not downsampling.
+    static constexpr int kZeroCrossings = 16;
+
+    // At most |max_output_frames| are produced per call to Process().
+    Resampler(int num_channels, int input_rate, int output_rate, int max_output_frames);
+    // Input frames that Process() needs to produce |num_output| frames.
+    int64_t InputFramesNeeded(int num_output) const;
+    // Upper bound of InputFramesNeeded().
+    int64_t MaxInputFrames() const { return max_input_frames; }
+    // Consume InputFramesNeeded(|num_output|) frames from |input| and write |num_output| frames
+    // to |output|. Output frame n is at input frame n * input_rate / output_rate, counted from the
+    // first input, so the input runs half a filter length ahead of the output.
+    void Process(const float* input, float* output, int num_output);
+    // Start over, as if no input had been consumed.
+    void Reset();
+    // Move the first output |offset| input frames, from 0 to 1, past the first input. Must be
+    // called before the first Process() after construction or Reset().
+    void SetOffset(double offset);
+
+   private:
+    // Write |num_output| frames from the history, with the vector operations of |Ops|.
+    template <class Ops>
+    void Filter(float* output, int num_output);
+
+    const int num_channels;
+    const int input_rate;
+    const int output_rate;
+    // Taps on each side of the output position, and all taps as a multiple of the SIMD width.
+    int half = 0;
+    int num_taps = 0;
+    int64_t max_input_frames = 0;
+    // Coefficients of kPhases + 1 fractional positions from 0 to 1, num_taps each.
+    std::vector<float> table;
+    // Input of the last num_taps frames and more, per channel.
+    std::vector<std::vector<float>> history;
+    int64_t history_frames = 0;
+    // Position of the next output frame. |first_tap| is the history index of its first tap and
+    // |fraction| / output_rate is its fractional part.
+    int64_t first_tap = 0;
+    int64_t fraction = 0;
+    // Coefficients of the current output frame.
+    std::vector<float> coefficients;
+};
+
+#endif
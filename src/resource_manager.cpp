@@ -0,0 +1,62 @@
+#include "resource_manager.hpp"
+#include <algorithm>
+#include <numeric>
+
+std::vector<ResourceManager::Eviction> ResourceManager::Plan(
+    const std::vector<Resident>& residents) {
+    cpu_usage = 0;
+    gpu_usage = 0;
+    std::vector<int> candidates;
+    for (size_t i = 0; i < residents.size(); i++) {
+        cpu_usage += residents[i].cpu_bytes;
+        gpu_usage += residents[i].gpu_bytes;
+        if (!residents[i].pinned) {
+            candidates.push_back(i);
+        }
+    }
+    std::stable_sort(candidates.begin(), candidates.end(), [&residents](int a, int b) {
+        return residents[a].last_viewed < residents[b].last_viewed;
+    });
+
+    std::vector<Eviction> evictions(residents.size(), KEEP);
+    size_t cpu = cpu_usage;
+    size_t gpu = gpu_usage;
+    for (const int i : candidates) {
+        const Resident& r = residents[i];
+        if (cpu > cpu_budget && r.cpu_bytes) {
+            evictions[i] = EVICT_ALL;
+            cpu -= r.cpu_bytes;
+            gpu -= r.gpu_bytes;
+        } else if (gpu > gpu_budget && r.gpu_bytes) {
+            evictions[i] = EVICT_GPU;
+            gpu -= r.gpu_bytes;
+        }
+    }
+    return evictions;
+}
+
+std::vector<ResourceManager::TileBudget> ResourceManager::TileBudgets(
+    const std::vector<Resident>& residents) const {
+    size_t cpu = cpu_budget;
+    size_t gpu = gpu_budget;
+    for (const Resident& r : residents) {
+        cpu -= std::min(cpu, r.cpu_bytes - r.cpu_tile_bytes);
+        gpu -= std::min(gpu, r.gpu_bytes - r.gpu_tile_bytes);
+    }
+
+    // Most recently viewed first.
+    std::vector<int> order(residents.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&residents](int a, int b) {
+        return residents[a].last_viewed > residents[b].last_viewed;
+    });
+
+    std::vector<TileBudget> budgets(residents.size());
+    for (const int i : order) {
+        budgets[i].cpu_bytes = cpu;
+        budgets[i].gpu_bytes = gpu;
+        cpu -= std::min(cpu, residents[i].cpu_tile_bytes);
+        gpu -= std::min(gpu, residents[i].gpu_tile_bytes);
+    }
+    return budgets;
+}
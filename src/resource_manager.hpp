@@ -0,0 +1,58 @@
+#ifndef RESOURCE_MANAGER_HPP
+#define RESOURCE_MANAGER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Keeps the heavy resources of the tracks within a CPU and a GPU memory budget. CPU memory holds
+// decoded samples and analysis results, GPU memory holds vertex buffers and spectrogram textures.
+// When over a budget, the resources of the least recently viewed tracks are evicted. They are
+// rebuilt when the tracks are in view again. Spectrogram tiles get what the other resources leave
+// of the budgets, so that the tiles of the least recently viewed tracks are evicted first.
+class ResourceManager {
+   public:
+    // Resources of one track.
+    struct Resident {
+        size_t cpu_bytes = 0;
+        size_t gpu_bytes = 0;
+        // Of the above, memory of spectrogram tiles.
+        size_t cpu_tile_bytes = 0;
+        size_t gpu_tile_bytes = 0;
+        // Frame when the track was last in view.
+        uint64_t last_viewed = 0;
+        // Resources of tracks that are in view, selected or playing are never evicted.
+        bool pinned = false;
+    };
+    enum Eviction { KEEP, EVICT_GPU, EVICT_ALL };
+    // Memory that the spectrogram tiles of a track may use.
+    struct TileBudget {
+        size_t cpu_bytes = 0;
+        size_t gpu_bytes = 0;
+        bool operator==(const TileBudget& other) const {
+            return cpu_bytes == other.cpu_bytes && gpu_bytes == other.gpu_bytes;
+        }
+    };
+
+    ResourceManager(size_t cpu_budget, size_t gpu_budget)
+        : cpu_budget(cpu_budget), gpu_budget(gpu_budget) {}
+    // What to evict from each of |residents| to get within budget, least recently viewed first.
+    // Evicting all resources of a track also frees its GPU memory.
+    std::vector<Eviction> Plan(const std::vector<Resident>& residents);
+    // Memory for the spectrogram tiles of each of |residents|: what the other resources leave of
+    // the budgets, minus the tiles of the more recently viewed tracks.
+    std::vector<TileBudget> TileBudgets(const std::vector<Resident>& residents) const;
+    size_t CpuBudget() const { return cpu_budget; }
+    size_t GpuBudget() const { return gpu_budget; }
+    // Usage before the evictions of the last plan.
+    size_t CpuUsage() const { return cpu_usage; }
+    size_t GpuUsage() const { return gpu_usage; }
+
+   private:
+    const size_t cpu_budget;
+    const size_t gpu_budget;
+    size_t cpu_usage = 0;
+    size_t gpu_usage = 0;
+};
+
+#endif
@@ -0,0 +1,122 @@
+#include "sample_convert.hpp"
+
+#include "cpu_features.hpp"
+
+#if defined(__SSE2__) || defined(HAVE_AVX2_KERNELS)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+#if defined(HAVE_AVX2_KERNELS)
+struct Avx2Ops {
+    static constexpr int kWidth = 16;
+    AVX2_OPS static void Convert(const int16_t* src, float* dest) {
+        const __m256 scale = _mm256_set1_ps(kInt16Scale);
+        const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 8));
+        _mm256_storeu_ps(dest, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(lo)), scale));
+        _mm256_storeu_ps(dest + 8,
+                         _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(hi)), scale));
+    }
+    static constexpr int kFloatWidth = 8;
+    AVX2_OPS static void AddScaled(const float* src, float gain, float* dest) {
+        const __m256 x = _mm256_mul_ps(_mm256_loadu_ps(src), _mm256_set1_ps(gain));
+        _mm256_storeu_ps(dest, _mm256_add_ps(_mm256_loadu_ps(dest), x));
+    }
+};
+#endif
+
+#if defined(__SSE2__)
+struct Simd4Ops {
+    static constexpr int kWidth = 8;
+    static void Convert(const int16_t* src, float* dest) {
+        const __m128 scale = _mm_set1_ps(kInt16Scale);
+        const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        // Sign extend by unpacking into the upper halves and shifting down.
+        const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+        const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+        _mm_storeu_ps(dest, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(dest + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+    static constexpr int kFloatWidth = 4;
+    static void AddScaled(const float* src, float gain, float* dest) {
+        const __m128 x = _mm_mul_ps(_mm_loadu_ps(src), _mm_set1_ps(gain));
+        _mm_storeu_ps(dest, _mm_add_ps(_mm_loadu_ps(dest), x));
+    }
+};
+#elif defined(__ARM_NEON)
+struct Simd4Ops {
+    static constexpr int kWidth = 8;
+    static void Convert(const int16_t* src, float* dest) {
+        const int16x8_t x = vld1q_s16(src);
+        vst1q_f32(dest, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), kInt16Scale));
+        vst1q_f32(dest + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), kInt16Scale));
+    }
+    static constexpr int kFloatWidth = 4;
+    static void AddScaled(const float* src, float gain, float* dest) {
+        vst1q_f32(dest, vmlaq_n_f32(vld1q_f32(dest), vld1q_f32(src), gain));
+    }
+};
+#endif
+
+template <class Ops>
+size_t Int16ToFloatSimd(const int16_t* src, size_t num_samples, float* dest) {
+    const size_t num_vector_samples = num_samples - num_samples % Ops::kWidth;
+    for (size_t i = 0; i < num_vector_samples; i += Ops::kWidth) {
+        Ops::Convert(src + i, dest + i);
+    }
+    return num_vector_samples;
+}
+
+template <class Ops>
+size_t AddScaledSimd(const float* src, float gain, size_t num_samples, float* dest) {
+    const size_t num_vector_samples = num_samples - num_samples % Ops::kFloatWidth;
+    for (size_t i = 0; i < num_vector_samples; i += Ops::kFloatWidth) {
+        Ops::AddScaled(src + i, gain, dest + i);
+    }
+    return num_vector_samples;
+}
+
+#if defined(HAVE_AVX2_KERNELS)
+AVX2_KERNEL size_t Int16ToFloatAvx2(const int16_t* src, size_t num_samples, float* dest) {
+    return Int16ToFloatSimd<Avx2Ops>(src, num_samples, dest);
+}
+
+AVX2_KERNEL size_t AddScaledAvx2(const float* src, float gain, size_t num_samples, float* dest) {
+    return AddScaledSimd<Avx2Ops>(src, gain, num_samples, dest);
+}
+#endif
+}  // namespace
+
+void Int16ToFloat(const int16_t* src, size_t num_samples, float* dest) {
+    size_t i = 0;
+#if defined(HAVE_AVX2_KERNELS)
+    if (kCpuHasAvx2) {
+        i = Int16ToFloatAvx2(src, num_samples, dest);
+    }
+#endif
+    // The narrower vectors take what remains of the wider ones.
+#if defined(__SSE2__) || defined(__ARM_NEON)
+    i += Int16ToFloatSimd<Simd4Ops>(src + i, num_samples - i, dest + i);
+#endif
+    for (; i < num_samples; i++) {
+        dest[i] = src[i] * kInt16Scale;
+    }
+}
+
+void AddScaled(const float* src, float gain, size_t num_samples, float* dest) {
+    size_t i = 0;
+#if defined(HAVE_AVX2_KERNELS)
+    if (kCpuHasAvx2) {
+        i = AddScaledAvx2(src, gain, num_samples, dest);
+    }
+#endif
+#if defined(__SSE2__) || defined(__ARM_NEON)
+    i += AddScaledSimd<Simd4Ops>(src + i, gain, num_samples - i, dest + i);
+#endif
+    for (; i < num_samples; i++) {
+        dest[i] += src[i] * gain;
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef SAMPLE_CONVERT_HPP
+#define SAMPLE_CONVERT_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Scale of 16-bit samples as floats, the same as libsndfile uses.
+constexpr float kInt16Scale = 1.f / 32768.f;
+
+// Factor from samples of the pointed-to type to floats in [-1, 1).
+constexpr float SampleScale(const float*) {
+    return 1.f;
+}
+constexpr float SampleScale(const int16_t*) {
+    return kInt16Scale;
+}
+
+// Convert |num_samples| 16-bit samples to floats in [-1, 1). Uses SIMD (AVX2 if the CPU has it, and
+// SSE2 or NEON depending on the build target).
+void Int16ToFloat(const int16_t* src, size_t num_samples, float* dest);
+
+// Add |num_samples| samples of |src| times |gain| to |dest|. Uses SIMD like Int16ToFloat().
+void AddScaled(const float* src, float gain, size_t num_samples, float* dest);
+
+#endif
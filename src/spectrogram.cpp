@@ -1,101 +1,328 @@
 #include "spectrogram.hpp"
-#include <fftw3.h>
-#include <omp.h>
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 
-namespace {
-constexpr float kDftScaleFactor = 1.f / kInputSize;
-}  // namespace
+#include "analysis_cache.hpp"
+#include "power_db.hpp"
+#include "sample_convert.hpp"
 
-Spectrogram::Spectrogram(const float* samples,
-                         int num_channels,
-                         int num_frames,
-                         std::mutex& fftw_mutex) {
-    // Hann window.
-    float window[kInputSize];
+namespace {
+float Window(WindowFunction window, int n, int size) {
     constexpr float pi = static_cast<float>(M_PI);
-    for (int n = 0; n < kInputSize; n++) {
-        window[n] = 0.5f * (1.f - std::cos(2.f * pi * n / (kInputSize - 1)));
+    const float x = 2.f * pi * n / (size - 1);
+    switch (window) {
+        case HANN:
+            return 0.5f * (1.f - std::cos(x));
+        case HAMMING:
+            return 0.54f - 0.46f * std::cos(x);
+        case BLACKMAN:
+            return 0.42f - 0.5f * std::cos(x) + 0.08f * std::cos(2.f * x);
+        default:
+            return 1.f;
+    }
+}
+
+// Multiply |size| frames of channel |c| from |first_frame| by |window|, with zeros outside the
+// file.
+template <class T>
+void ApplyWindow(const T* samples,
+                 int num_channels,
+                 int64_t num_frames,
+                 int c,
+                 int64_t first_frame,
+                 const std::vector<float>& window,
+                 float* dest) {
+    int64_t src_frame = first_frame;
+    for (size_t k = 0; k < window.size(); k++) {
+        if (src_frame >= 0 && src_frame < num_frames) {
+            dest[k] = samples[src_frame * num_channels + c] * window[k];
+        } else {
+            dest[k] = 0.f;
+        }
+        src_frame++;
     }
+}
 
-    // Add kInputAdvance samples at the beginning,
-    const int start_index = -kInputAdvance;
-    // Add between kInputAdvance and kInputSize samples at the end.
-    const int end_index = kInputAdvance * ((num_frames + kInputSize - 1) / kInputAdvance);
-    // Number of power spectra (DFTs) per channel.
-    const int num_spectra_per_chanel = (end_index - start_index) / kInputAdvance - 1;
+// Number of spectra of a channel that are computed by one part of a tile.
+constexpr int kSpectraPerPart = 64;
 
-    power_spectra.resize(num_channels);
-    for (int c = 0; c < num_channels; c++) {
-        power_spectra[c].resize(num_spectra_per_chanel);
+// Fill |tile| with power spectra, starting with spectrum |first_spectrum|.
+void ComputeTile(const AudioBuffer& ab,
+                 int first_spectrum,
+                 int hop,
+                 fftwf_plan plan,
+                 const std::vector<float>& window,
+                 const CancellationToken& cancel,
+                 Spectrogram::Tile* tile) {
+    const int num_channels = ab.NumChannels();
+    const int64_t num_frames = ab.NumFrames();
+    const int num_spectra = tile->NumSpectra();
+    const int input_size = window.size();
+
+    // The window also converts the samples to floats.
+    const float sample_scale =
+        ab.VisitSamples([](const auto* samples) { return SampleScale(samples); });
+    std::vector<float> scaled_window(window);
+    for (float& w : scaled_window) {
+        w *= sample_scale;
     }
+    const int output_size = tile->OutputSize();
+    const float dft_scale_factor = 1.f / input_size;
 
-    const int num_threads = omp_get_max_threads();
-    std::vector<float*> input_buffers(num_threads, nullptr);
-    std::vector<fftwf_complex*> output_buffers(num_threads, nullptr);
-    std::vector<fftwf_plan> plans(num_threads);
+    // Spectra are centered at multiples of |hop|, so the first one is padded with zeros.
+    const int64_t start_index = -input_size / 2;
 
-    {
-        std::scoped_lock fftw_lock(fftw_mutex);
-        for (int t = 0; t < num_threads; t++) {
-            input_buffers[t] = static_cast<float*>(fftwf_malloc(kInputSize * sizeof(float)));
-            output_buffers[t] =
-                static_cast<fftwf_complex*>(fftwf_malloc(kOutputSize * sizeof(fftwf_complex)));
-            plans[t] = fftwf_plan_dft_r2c_1d(kInputSize, input_buffers[t], output_buffers[t],
-                                             FFTW_ESTIMATE);
+    const int parts_per_channel = (num_spectra + kSpectraPerPart - 1) / kSpectraPerPart;
+    TaskScheduler::ParallelFor(num_channels * parts_per_channel, [&](int64_t part) {
+        if (cancel.Cancelled())
+            return;
+        const int c = part / parts_per_channel;
+        const int first = (part % parts_per_channel) * kSpectraPerPart;
+        const int last = std::min(first + kSpectraPerPart, num_spectra);
+
+        // Buffers from fftwf_malloc() have the alignment that the shared plan was made for.
+        float* input_buffer = static_cast<float*>(fftwf_malloc(input_size * sizeof(float)));
+        fftwf_complex* output_buffer =
+            static_cast<fftwf_complex*>(fftwf_malloc(output_size * sizeof(fftwf_complex)));
+
+        for (int i = first; i < last; i++) {
+            // Fill input buffer and apply window.
+            const int64_t first_frame =
+                start_index + static_cast<int64_t>(first_spectrum + i) * hop;
+            ab.VisitSamples([&](const auto* samples) {
+                ApplyWindow(samples, num_channels, num_frames, c, first_frame, scaled_window,
+                            input_buffer);
+            });
+
+            // Transform.
+            fftwf_execute_dft_r2c(plan, input_buffer, output_buffer);
+
+            // Power spectrum in dB, quantized to 16 bits.
+            PowerToDb16(&output_buffer[0][0], output_size, dft_scale_factor,
+                        tile->MutableData(c, i));
         }
+
+        fftwf_free(input_buffer);
+        fftwf_free(output_buffer);
+    });
+}
+}  // namespace
+
+const char* SpectrogramSettings::WindowName() const {
+    switch (window) {
+        case HANN:
+            return "Hann";
+        case HAMMING:
+            return "Hamming";
+        case BLACKMAN:
+            return "Blackman";
+        default:
+            return "Rectangular";
     }
+}
+
+Spectrogram::Tile::Tile(int num_channels, int num_spectra, int output_size)
+    : num_channels(num_channels),
+      num_spectra(num_spectra),
+      output_size(output_size),
+      power_spectra(static_cast<size_t>(num_channels) * num_spectra * output_size) {
+    data = power_spectra.data();
+}
+
+Spectrogram::Tile::Tile(std::unique_ptr<MappedFile> mapping,
+                        const uint16_t* data,
+                        int num_channels,
+                        int num_spectra,
+                        int output_size)
+    : num_channels(num_channels),
+      num_spectra(num_spectra),
+      output_size(output_size),
+      data(data),
+      mapping(std::move(mapping)) {}
+
+Spectrogram::Spectrogram(std::shared_ptr<const AudioBuffer> audio_buffer,
+                         const SpectrogramSettings& settings,
+                         FftPlans& fft_plans,
+                         const AnalysisCache& cache,
+                         TaskScheduler& scheduler,
+                         std::shared_ptr<const TaskGroup> track_tasks)
+    : audio_buffer(std::move(audio_buffer)),
+      settings(settings),
+      fft_plans(fft_plans),
+      cache(cache),
+      scheduler(scheduler),
+      tasks(std::make_shared<TaskGroup>(std::move(track_tasks))) {
+    // Number of power spectra (DFTs) per channel. The spectra are centered at multiples of the hop
+    // size and the last one is centered at or after the last sample.
+    num_frames = this->audio_buffer->NumFrames();
+    num_spectra = (std::max<int64_t>(num_frames, 1) - 1) / settings.hop + 2;
 
-#pragma omp parallel
+    // Tiles share one spectrum with the previous tile.
+    tiles.resize((std::max(num_spectra - 1, 1) + kSpectraPerTile - 2) / (kSpectraPerTile - 1));
+
+    std::scoped_lock lock(mutex);
+    Schedule();
+}
+
+Spectrogram::~Spectrogram() {
+    std::future<void> task;
     {
-        float* input_buffer = input_buffers[omp_get_thread_num()];
-        fftwf_complex* output_buffer = output_buffers[omp_get_thread_num()];
-        fftwf_plan plan = plans[omp_get_thread_num()];
-
-        for (int c = 0; c < num_channels; c++) {
-            auto& power_spectra_channel = power_spectra[c];
-
-#pragma omp for
-            for (int i = 0; i < num_spectra_per_chanel; i++) {
-                // Fill input buffer and apply Hann window.
-                int src_frame = start_index + i * kInputAdvance;
-                for (int k = 0; k < kInputSize; k++) {
-                    if (src_frame >= 0 && src_frame < num_frames) {
-                        input_buffer[k] = samples[src_frame * num_channels + c] * window[k];
-                    } else {
-                        input_buffer[k] = 0.f;
-                    }
-                    src_frame++;
-                }
+        std::scoped_lock lock(mutex);
+        stop = true;
+        task = std::move(pending_task);
+    }
+    // A queued task is dropped, which makes its future ready. A running task stops at the next
+    // part of its tile.
+    scheduler.Cancel(*tasks);
+    if (task.valid())
+        task.wait();
+}
 
-                // Transform.
-                fftwf_execute(plan);
-
-                // Power spectrum.
-                auto& power = power_spectra_channel[i];
-                for (int k = 0; k < kOutputSize; k++) {
-                    const float re = output_buffer[k][0] * kDftScaleFactor;
-                    const float im = output_buffer[k][1] * kDftScaleFactor;
-
-                    // Power in dB domain.
-                    constexpr float min_dB = -100.f;
-                    constexpr float max_dB = -20.f;
-                    constexpr float scaling = 65535.f / (max_dB - min_dB);
-                    float dB =
-                        std::max(min_dB, std::min(max_dB, 10.f * std::log10(re * re + im * im)));
-                    power[k] = (dB - min_dB) * scaling;
+void Spectrogram::SetView(int first_tile, int last_tile) {
+    std::scoped_lock lock(mutex);
+    view_first_tile = first_tile;
+    view_last_tile = last_tile;
+    // Also picks up tiles whose frames were loaded since the last call.
+    Schedule();
+}
+
+size_t Spectrogram::MemoryUsage() const {
+    std::scoped_lock lock(mutex);
+    return resident_bytes;
+}
+
+void Spectrogram::SetMemoryBudget(size_t bytes) {
+    std::scoped_lock lock(mutex);
+    memory_budget = bytes;
+    Evict();
+    // Also picks up tiles that fit in a larger budget.
+    Schedule();
+}
+
+std::shared_ptr<const Spectrogram::Tile> Spectrogram::GetTile(int tile) const {
+    std::scoped_lock lock(mutex);
+    return tiles[tile];
+}
+
+void Spectrogram::Schedule() {
+    if (stop || pending_task.valid())
+        return;
+    const int tile = NextTile();
+    if (tile < 0)
+        return;
+    // Tiles outside of the view wait for the foreground work of all tracks.
+    pending_task = scheduler.Submit(
+        tasks, [this] { ComputeNextTile(); }, Distance(tile) > 0);
+}
+
+void Spectrogram::ComputeNextTile() {
+    std::unique_lock lock(mutex);
+    // The view may have changed since the task was queued.
+    const int tile = NextTile();
+    if (tile >= 0 && !stop) {
+        // Compute without holding the lock, so that the view can be updated meanwhile.
+        lock.unlock();
+        const AudioBuffer& ab = *audio_buffer;
+        std::shared_ptr<const Tile> data = cache.LoadSpectrogramTile(
+            ab.FileIdentity(), settings, tile, ab.NumChannels(), TileSize(tile));
+        if (!data) {
+            if (!plan) {
+                plan = fft_plans.RealToComplex(settings.fft_size);
+                window.resize(settings.fft_size);
+                for (int n = 0; n < settings.fft_size; n++) {
+                    window[n] = Window(settings.window, n, settings.fft_size);
                 }
             }
+            auto computed =
+                std::make_shared<Tile>(ab.NumChannels(), TileSize(tile), settings.OutputSize());
+            const CancellationToken cancel(tasks);
+            ComputeTile(ab, FirstSpectrum(tile), settings.hop, plan, window, cancel,
+                        computed.get());
+            // A partly computed tile is dropped, and so is a tile that was zero-padded past the
+            // actual end of the file.
+            if (!cancel.Cancelled() && !Outdated()) {
+                cache.StoreSpectrogramTile(ab.FileIdentity(), settings, tile, *computed);
+                data = std::move(computed);
+            }
+        }
+        lock.lock();
+
+        if (data) {
+            resident_bytes += data->Bytes();
+            tiles[tile] = std::move(data);
+            Evict();
         }
     }
 
-    {
-        std::scoped_lock fftw_lock(fftw_mutex);
-        for (int t = 0; t < num_threads; t++) {
-            fftwf_destroy_plan(plans[t]);
-            fftwf_free(input_buffers[t]);
-            fftwf_free(output_buffers[t]);
+    // One tile per task, so that the tiles of other tracks are scheduled in between.
+    pending_task = {};
+    Schedule();
+}
+
+int Spectrogram::Distance(int tile) const {
+    if (tile < view_first_tile)
+        return view_first_tile - tile;
+    if (tile > view_last_tile)
+        return tile - view_last_tile;
+    return 0;
+}
+
+bool Spectrogram::Loaded(int tile) const {
+    // The last spectrum of the tile is centered at its last hop and extends half an FFT further.
+    const int64_t last_spectrum = FirstSpectrum(tile) + TileSize(tile) - 1;
+    const int64_t end_frame = last_spectrum * settings.hop + settings.fft_size / 2;
+    return audio_buffer->Loaded() || end_frame <= audio_buffer->LoadedFrames();
+}
+
+bool Spectrogram::Outdated() const {
+    return audio_buffer->Loaded() && audio_buffer->NumFrames() != num_frames;
+}
+
+int Spectrogram::NextTile() const {
+    // Nothing more is computed for a spectrogram that is about to be replaced.
+    if (Outdated())
+        return -1;
+
+    // Closest missing tile that is loaded and farthest resident tile.
+    int closest = -1;
+    int farthest = -1;
+    for (int tile = 0; tile < NumTiles(); tile++) {
+        if (!tiles[tile]) {
+            if (!Loaded(tile))
+                continue;
+            if (closest < 0 || Distance(tile) < Distance(closest))
+                closest = tile;
+        } else if (farthest < 0 || Distance(tile) > Distance(farthest)) {
+            farthest = tile;
+        }
+    }
+    if (closest < 0)
+        return -1;
+
+    // Tiles in view are always computed. Other tiles are computed while within budget, or if they
+    // are closer to the view than a tile that can be evicted instead.
+    const size_t bytes = static_cast<size_t>(NumChannels()) * TileSize(closest) *
+                         settings.OutputSize() * sizeof(uint16_t);
+    if (Distance(closest) == 0 || resident_bytes + bytes <= memory_budget ||
+        (farthest >= 0 && Distance(farthest) > Distance(closest))) {
+        return closest;
+    }
+    return -1;
+}
+
+void Spectrogram::Evict() {
+    while (resident_bytes > memory_budget) {
+        int farthest = -1;
+        for (int tile = 0; tile < NumTiles(); tile++) {
+            if (tiles[tile] && Distance(tile) > 0 &&
+                (farthest < 0 || Distance(tile) > Distance(farthest))) {
+                farthest = tile;
+            }
         }
+        if (farthest < 0)
+            return;
+        resident_bytes -= tiles[farthest]->Bytes();
+        tiles[farthest].reset();
     }
 }
@@ -1,29 +1,152 @@
 #ifndef SPECTROGRAM_HPP
 #define SPECTROGRAM_HPP
 
-#include <array>
+#include <cstdint>
+#include <future>
+#include <memory>
 #include <mutex>
 #include <vector>
 
-constexpr int kInputSize = 1024;
-constexpr int kInputAdvance = kInputSize / 2;
-constexpr int kOutputSize = kInputSize / 2 + 1;
+#include "audio_buffer.hpp"
+#include "fft_plans.hpp"
+#include "mapped_file.hpp"
+#include "task_scheduler.hpp"
 
+class AnalysisCache;
+
+enum WindowFunction { HANN, HAMMING, BLACKMAN, RECTANGULAR, NUM_WINDOW_FUNCTIONS };
+
+// Analysis parameters of a spectrogram.
+struct SpectrogramSettings {
+    static constexpr int kMinFftSize = 128;
+    static constexpr int kMaxFftSize = 8192;
+
+    int fft_size = 1024;
+    // Number of samples between consecutive spectra.
+    int hop = 512;
+    WindowFunction window = HANN;
+
+    int OutputSize() const { return fft_size / 2 + 1; }
+    const char* WindowName() const;
+    bool operator==(const SpectrogramSettings& other) const {
+        return fft_size == other.fft_size && hop == other.hop && window == other.window;
+    }
+    bool operator!=(const SpectrogramSettings& other) const { return !(*this == other); }
+};
+
+// Power spectra of an audio buffer, split in tiles of kSpectraPerTile spectra. Neighboring tiles
+// share one spectrum in order to support perfect transitions between tiles. Tiles are computed on
+// demand by scheduler tasks, one tile per task: first the tiles in view, then the rest of the file
+// ordered by the distance to the view. Tiles far from the view are evicted when over the memory
+// budget that the resource manager gives the track.
 class Spectrogram {
    public:
-    Spectrogram(const float* samples, int num_channels, int num_frames, std::mutex& fftw_mutex);
-    int NumChannels() const { return power_spectra.size(); }
-    int NumPowerSpectrumPerChannel() const {
-        return power_spectra.size() ? power_spectra[0].size() : 0;
-    }
-    int Advance() const { return kInputAdvance; }
-    int OutputSize() const { return kOutputSize; }
-    const uint16_t* Data(int channel, int spectrum) const {
-        return power_spectra[channel][spectrum].data();
+    static constexpr int kSpectraPerTile = 1024;
+
+    // Power spectra of all channels of a tile, stored as [channel][spectrum][bin].
+    class Tile {
+       public:
+        Tile(int num_channels, int num_spectra, int output_size);
+        // Spectra that point into a memory-mapped file, e.g. from the analysis cache.
+        Tile(std::unique_ptr<MappedFile> mapping,
+             const uint16_t* data,
+             int num_channels,
+             int num_spectra,
+             int output_size);
+        int NumChannels() const { return num_channels; }
+        int NumSpectra() const { return num_spectra; }
+        int OutputSize() const { return output_size; }
+        const uint16_t* Data(int channel, int spectrum) const {
+            return data + (static_cast<size_t>(channel) * num_spectra + spectrum) * output_size;
+        }
+        uint16_t* MutableData(int channel, int spectrum) {
+            return &power_spectra[(static_cast<size_t>(channel) * num_spectra + spectrum) *
+                                  output_size];
+        }
+        size_t Bytes() const {
+            return static_cast<size_t>(num_channels) * num_spectra * output_size * sizeof(uint16_t);
+        }
+
+       private:
+        int num_channels;
+        int num_spectra;
+        int output_size;
+        // Points either into |power_spectra| or into |mapping|.
+        const uint16_t* data;
+        std::vector<uint16_t> power_spectra;
+        std::unique_ptr<MappedFile> mapping;
+    };
+
+    Spectrogram(std::shared_ptr<const AudioBuffer> audio_buffer,
+                const SpectrogramSettings& settings,
+                FftPlans& fft_plans,
+                const AnalysisCache& cache,
+                TaskScheduler& scheduler,
+                std::shared_ptr<const TaskGroup> track_tasks);
+    // Cancels a running task and waits for it to stop, which takes at most a part of a tile.
+    ~Spectrogram();
+    const SpectrogramSettings& Settings() const { return settings; }
+    // Frames that the tiles are laid out for. A file can end before the length in its header, and
+    // then needs a new spectrogram once it is loaded.
+    int64_t NumFrames() const { return num_frames; }
+    int NumChannels() const { return audio_buffer->NumChannels(); }
+    int NumPowerSpectrumPerChannel() const { return num_spectra; }
+    int Advance() const { return settings.hop; }
+    int OutputSize() const { return settings.OutputSize(); }
+
+    int NumTiles() const { return tiles.size(); }
+    int FirstSpectrum(int tile) const { return tile * (kSpectraPerTile - 1); }
+    int TileSize(int tile) const {
+        return std::min(kSpectraPerTile, num_spectra - FirstSpectrum(tile));
     }
+    // Prioritize the tiles from |first_tile| to |last_tile|, inclusive. Called regularly, since
+    // tiles are only computed once their frames are loaded.
+    void SetView(int first_tile, int last_tile);
+    // Returns nullptr if the tile is not computed (yet).
+    std::shared_ptr<const Tile> GetTile(int tile) const;
+    // Memory of the resident tiles.
+    size_t MemoryUsage() const;
+    // Evict the tiles farthest from the view until within |bytes|, and compute no more than fit.
+    // Tiles in view are computed and kept regardless. Nothing else fits until it is set.
+    void SetMemoryBudget(size_t bytes);
 
    private:
-    std::vector<std::vector<std::array<uint16_t, kOutputSize>>> power_spectra;
+    // Queue a task for the next tile unless one is pending. Called with |mutex| held.
+    void Schedule();
+    void ComputeNextTile();
+    // All frames of the tile are loaded into the audio buffer.
+    bool Loaded(int tile) const;
+    // The audio buffer is loaded and has a different length than the tiles are laid out for.
+    bool Outdated() const;
+    // Distance in tiles from the view. Zero for tiles in view.
+    int Distance(int tile) const;
+    // Next tile to compute, or -1 if there is nothing to do. Called with |mutex| held.
+    int NextTile() const;
+    // Evict tiles until within budget. Called with |mutex| held.
+    void Evict();
+
+    std::shared_ptr<const AudioBuffer> audio_buffer;
+    const SpectrogramSettings settings;
+    FftPlans& fft_plans;
+    const AnalysisCache& cache;
+    TaskScheduler& scheduler;
+    // Child of the group of the track, cancelled when the spectrogram is destroyed.
+    const std::shared_ptr<TaskGroup> tasks;
+    int64_t num_frames = 0;
+    int num_spectra = 0;
+    // Made by the first task that computes a tile. Tasks of a spectrogram never run concurrently.
+    fftwf_plan plan = nullptr;
+    std::vector<float> window;
+
+    mutable std::mutex mutex;
+    // Queued or running task for the next tile.
+    std::future<void> pending_task;
+    std::vector<std::shared_ptr<const Tile>> tiles;
+    size_t resident_bytes = 0;
+    size_t memory_budget = 0;
+    int view_first_tile = 0;
+    int view_last_tile = 0;
+    bool stop = false;
 };
 
 #endif
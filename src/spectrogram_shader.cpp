@@ -59,7 +59,6 @@ void SpectrogramShader::Init() {
 }
 
 void SpectrogramShader::Draw(const glm::mat4& mvp,
-                             float start_time,
                              float samplerate,
                              bool bark,
                              float vertical_zoom) {
@@ -69,6 +68,9 @@ void SpectrogramShader::Draw(const glm::mat4& mvp,
     glUniform1f(2, nyquist_freq);
     glUniform1f(3, 26.81f * nyquist_freq / (1960.f + nyquist_freq) - 0.53f);
     glUniform1i(4, bark);
-    glUniform1f(5, start_time);
     glUniform1f(6, vertical_zoom);
 }
+
+void SpectrogramShader::SetStartTime(float start_time) {
+    glUniform1f(5, start_time);
+}
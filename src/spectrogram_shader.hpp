@@ -7,11 +7,9 @@
 class SpectrogramShader : public Shader {
    public:
     void Init();
-    void Draw(const glm::mat4& mvp,
-              float start_time,
-              float samplerate,
-              bool bark,
-              float vertical_zoom);
+    void Draw(const glm::mat4& mvp, float samplerate, bool bark, float vertical_zoom);
+    // Start time of the view, relative to the origin of the vertices being drawn.
+    void SetStartTime(float start_time);
 };
 
 #endif
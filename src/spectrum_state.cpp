@@ -10,6 +10,7 @@
 #include <fftw3.h>
 
 #include "implot.h"
+#include "sample_convert.hpp"
 
 constexpr int kFftSize = 4096;
 static_assert((kFftSize & (kFftSize - 1)) == 0, "kFftSize must be a power of 2");
@@ -63,7 +64,7 @@ std::string string_format(const std::string& format, Args... args) {
 
 }  // namespace
 
-void SpectrumState::Add(const Track& track, float begin, float end, int channel) {
+void SpectrumState::Add(const Track& track, double begin, double end, int channel) {
     if (end < begin)
         std::swap(end, begin);
     if (track.audio_buffer == nullptr)
@@ -86,42 +87,37 @@ void SpectrumState::Add(const Track& track, float begin, float end, int channel)
         s.frequencies[n] = static_cast<float>(track.audio_buffer->Samplerate()) * n / kFftSize;
     }
     s.future_spectrum = std::async([audio = track.audio_buffer, channel, begin, end,
-                                    &fftw_mutex = fftw_mutex_]() {
-        const float duration = end - begin;
-        const int num_frames =
-            std::min(audio->NumFrames(), static_cast<int>(duration * audio->Samplerate()));
+                                    &fft_plans = fft_plans_]() {
+        const double duration = end - begin;
+        const int64_t num_frames = std::min(audio->NumFrames(),
+                                            static_cast<int64_t>(duration * audio->Samplerate()));
         std::vector<float> output(kFftOutputSize);
         std::vector<float, FftwAllocator<float>> input(kFftSize);
         std::vector<std::complex<float>, FftwAllocator<std::complex<float>>> fft_output(
             kFftOutputSize);
-        fftwf_plan plan;
-        {
-            std::scoped_lock locked_fftw_mutex(fftw_mutex);
-            plan = fftwf_plan_dft_r2c_1d(kFftSize, input.data(),
-                                         reinterpret_cast<fftwf_complex*>(fft_output.data()),
-                                         FFTW_ESTIMATE);
-        }
+        // Buffers from FftwAllocator are aligned.
+        const fftwf_plan plan = fft_plans.RealToComplex(kFftSize);
         const int window_size = kWindowSizeMs * audio->Samplerate() / 1000;
         int count = 0;
-        for (int start = 0; start + window_size < num_frames; start += window_size / 4, ++count) {
-            auto input_it = input.begin();
-            const float* a = audio->Samples() + start * audio->NumChannels() + channel;
-            for (int k = 0; k < window_size; ++k, ++input_it) {
-                *input_it = *a;
-                a += audio->NumChannels();
-            }
-            std::fill(input_it, input.end(), 0.0f);
-            fftwf_execute(plan);
+        for (int64_t start = 0; start + window_size < num_frames;
+             start += window_size / 4, ++count) {
+            audio->VisitSamples([&](const auto* samples) {
+                const float scale = SampleScale(samples);
+                const auto* a = samples + start * audio->NumChannels() + channel;
+                for (int k = 0; k < window_size; ++k) {
+                    input[k] = *a * scale;
+                    a += audio->NumChannels();
+                }
+            });
+            std::fill(input.begin() + window_size, input.end(), 0.0f);
+            fftwf_execute_dft_r2c(plan, input.data(),
+                                  reinterpret_cast<fftwf_complex*>(fft_output.data()));
             for (int k = 0; k < kFftOutputSize; ++k) {
                 const float r = fft_output[k].real();
                 const float i = fft_output[k].imag();
                 output[k] += r * r + i * i;
             }
         }
-        {
-            std::scoped_lock locked_fftw_mutex(fftw_mutex);
-            fftwf_destroy_plan(plan);
-        }
         if (count > 0) {
             const float scale =
                 1.0f / (static_cast<float>(window_size) * static_cast<float>(window_size) * count);
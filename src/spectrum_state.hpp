@@ -5,6 +5,7 @@
 #include <list>
 #include <string>
 #include <vector>
+#include "fft_plans.hpp"
 #include "state.hpp"
 
 struct Spectrum {
@@ -29,16 +30,24 @@ struct Spectrum {
 
 class SpectrumState {
    public:
-    explicit SpectrumState(std::mutex& fftw_mutex) : fftw_mutex_(fftw_mutex) {}
+    explicit SpectrumState(FftPlans& fft_plans) : fft_plans_(fft_plans) {}
 
-    void Add(const Track& track, float begin, float end, int channel);
+    void Add(const Track& track, double begin, double end, int channel);
     void Remove(std::list<Spectrum>::iterator it) { spectrums_.erase(it); }
 
     std::list<Spectrum>& spectrums() { return spectrums_; }
+    // Some spectrum is still being computed.
+    bool Pending() const {
+        for (const Spectrum& s : spectrums_) {
+            if (s.future_spectrum.valid())
+                return true;
+        }
+        return false;
+    }
 
    private:
     std::list<Spectrum> spectrums_;
-    std::mutex& fftw_mutex_;
+    FftPlans& fft_plans_;
 };
 
 #endif  // SPECTRUM_STATE_HPP_
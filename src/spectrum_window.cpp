@@ -91,7 +91,7 @@ void SpectrumWindow::Draw() {
     }
 }
 
-void SpectrumWindow::AddSpectrumFromTrack(const Track& t, float begin, float end, int channel) {
+void SpectrumWindow::AddSpectrumFromTrack(const Track& t, double begin, double end, int channel) {
     std::cerr << "SpectrumWindow: Got Spectrum add channel " << channel << std::endl;
     state_->Add(t, begin, end, channel);
 }
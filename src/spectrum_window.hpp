@@ -16,7 +16,7 @@ class SpectrumWindow {
     bool visible() const { return visible_; }
     void Draw();
 
-    void AddSpectrumFromTrack(const Track& t, float begin, float end, int channel);
+    void AddSpectrumFromTrack(const Track& t, double begin, double end, int channel);
 
    private:
     SpectrumState* state_ = nullptr;
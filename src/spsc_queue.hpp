@@ -0,0 +1,41 @@
+#ifndef SPSC_QUEUE_HPP
+#define SPSC_QUEUE_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Fixed-size queue between one producer thread and one consumer thread. Push() and Pop() never
+// lock or allocate, so they can be used on the audio thread. Holds up to N - 1 items.
+template <class T, size_t N>
+class SpscQueue {
+   public:
+    // Returns false if the queue is full.
+    bool Push(const T& item) {
+        const size_t tail = this->tail.load(std::memory_order_relaxed);
+        const size_t next = (tail + 1) % N;
+        if (next == head.load(std::memory_order_acquire))
+            return false;
+        items[tail] = item;
+        this->tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // Returns false if the queue is empty.
+    bool Pop(T* item) {
+        const size_t head = this->head.load(std::memory_order_relaxed);
+        if (head == tail.load(std::memory_order_acquire))
+            return false;
+        *item = items[head];
+        this->head.store((head + 1) % N, std::memory_order_release);
+        return true;
+    }
+
+   private:
+    std::array<T, N> items;
+    // Written by the consumer and the producer, respectively.
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+};
+
+#endif
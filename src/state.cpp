@@ -2,6 +2,8 @@
 #include <sys/stat.h>
 #include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstdlib>
 #include <fstream>
 #include <optional>
 
@@ -28,6 +30,107 @@ std::optional<std::string> GetLabelFromLofOptionString(const std::string& option
     return label;
 }
 
+double GetOffsetFromLofOptionString(const std::string& options) {
+    std::string::size_type n = options.find("offset ");
+    if (n == std::string::npos) {
+        return 0.0;
+    }
+    return std::strtod(options.c_str() + n + 7, nullptr);
+}
+
+float GetGainFromLofOptionString(const std::string& options) {
+    std::string::size_type n = options.find("gain ");
+    if (n == std::string::npos) {
+        return 0.f;
+    }
+    return std::strtof(options.c_str() + n + 5, nullptr);
+}
+
+// Output channels are numbered from 1 in the list of files.
+std::optional<int> GetOutputFromLofOptionString(const std::string& options) {
+    std::string::size_type n = options.find("output ");
+    if (n == std::string::npos) {
+        return std::nullopt;
+    }
+    const long channel = std::strtol(options.c_str() + n + 7, nullptr, 10);
+    if (channel < 1) {
+        return std::nullopt;
+    }
+    return static_cast<int>(channel - 1);
+}
+
+float DbToGain(float db) {
+    return std::pow(10.f, db / 20.f);
+}
+
+// Open the file of |t| and load it in the background. The future is ready as soon as the file is
+// opened, while the samples are still being loaded.
+std::future<std::shared_ptr<AudioBuffer>> LoadAudioBuffer(TaskScheduler& scheduler,
+                                                         const Track& t,
+                                                         int decode_threads) {
+    auto opened = std::make_shared<std::promise<std::shared_ptr<AudioBuffer>>>();
+    std::future<std::shared_ptr<AudioBuffer>> future = opened->get_future();
+    scheduler.Submit(t.load_tasks,
+                     [path = t.path, opened, cancel = CancellationToken(t.load_tasks),
+                      decode_threads] {
+                         auto audio_buffer = std::make_shared<AudioBuffer>(path);
+                         opened->set_value(audio_buffer);
+                         audio_buffer->Load(cancel, decode_threads);
+                     });
+    return future;
+}
+
+// Compute the blocks of the frames of |t| that are loaded since the last update of its low-res
+// waveform. The first update creates the waveform, or loads it from the cache. Complete waveforms
+// are stored in the cache.
+std::future<std::shared_ptr<LowResWaveform>> UpdateLowResWaveform(TaskScheduler& scheduler,
+                                                                  const Track& t,
+                                                                  const AnalysisCache& cache) {
+    return scheduler.Submit(
+        t.load_tasks, [waveform = t.lowres_waveform, audio_buffer = t.audio_buffer, &cache,
+                       cancel = CancellationToken(t.load_tasks)]() mutable {
+            const AudioBuffer& ab = *audio_buffer;
+            if (!waveform) {
+                waveform = cache.LoadWaveform(ab.FileIdentity());
+                if (waveform && waveform->NumChannels() == ab.NumChannels())
+                    return waveform;
+                waveform = std::make_shared<LowResWaveform>(ab);
+            }
+            waveform->Update(ab, cancel);
+            if (waveform->Complete()) {
+                cache.StoreWaveform(ab.FileIdentity(), *waveform);
+            }
+            return waveform;
+        });
+}
+
+// Memory of the resources of |t|.
+ResourceManager::Resident MemoryOf(const Track& t) {
+    ResourceManager::Resident r;
+    if (t.audio_buffer) {
+        r.cpu_bytes += t.audio_buffer->MemoryUsage();
+    }
+    if (t.lowres_waveform) {
+        r.cpu_bytes += t.lowres_waveform->MemoryUsage();
+    }
+    for (const Spectrogram* spectrogram : {t.spectrogram.get(), t.next_spectrogram.get()}) {
+        if (spectrogram) {
+            r.cpu_tile_bytes += spectrogram->MemoryUsage();
+        }
+    }
+    if (t.gpu_waveform) {
+        r.gpu_bytes += t.gpu_waveform->MemoryUsage();
+    }
+    for (const GpuSpectrogram* gpu_spectrogram :
+         {t.gpu_spectrogram.get(), t.next_gpu_spectrogram.get()}) {
+        if (gpu_spectrogram) {
+            r.gpu_tile_bytes += gpu_spectrogram->MemoryUsage();
+        }
+    }
+    r.cpu_bytes += r.cpu_tile_bytes;
+    r.gpu_bytes += r.gpu_tile_bytes;
+    return r;
+}
 }  // namespace
 
 Track::Track(const std::string& filename, std::optional<std::string> track_label) : path(filename) {
@@ -50,12 +153,20 @@ void Track::Reload() {
     }
 }
 
-void State::LoadFile(const std::string& file_name, std::optional<std::string> label) {
+void State::LoadFile(const std::string& file_name,
+                     std::optional<std::string> label,
+                     double offset,
+                     float gain_db,
+                     std::optional<int> output_channel) {
     if (file_name.size() >= 4 && file_name.substr(file_name.size() - 4).compare(".lof") == 0) {
         return LoadListOfFiles(file_name);
     }
 
     Track track(file_name, label);
+    track.id = next_id++;
+    track.offset = offset;
+    track.gain_db = gain_db;
+    track.output_channel = output_channel;
     if (track_change_notifier_) {
         MonitorTrack(track);
     }
@@ -92,21 +203,19 @@ void State::LoadListOfFiles(const std::string& file_name) {
                 std::string options_string = line.substr(end_filename, line.size());
 
                 // Load.
-                LoadFile(path, GetLabelFromLofOptionString(options_string));
+                LoadFile(path, GetLabelFromLofOptionString(options_string),
+                         GetOffsetFromLofOptionString(options_string),
+                         GetGainFromLofOptionString(options_string),
+                         GetOutputFromLofOptionString(options_string));
             }
         }
     }
 }
 
 void State::UnloadFiles() {
-    // Make sure async work is completed.
+    // Drop queued work. Running tasks stop early in the background.
     for (Track& t : tracks) {
-        if (t.future_audio_buffer.valid())
-            t.future_audio_buffer.wait();
-        if (t.future_lowres_waveform.valid())
-            t.future_lowres_waveform.wait();
-        if (t.future_spectrogram.valid())
-            t.future_spectrogram.wait();
+        scheduler_.Cancel(*t.tasks);
     }
 
     tracks.clear();
@@ -146,6 +255,7 @@ void State::StartMonitoringTrackChange() {
                 t.Reload();
             }
         }
+        wake_up_();
     });
     for (Track& t : tracks) {
         MonitorTrack(t);
@@ -161,54 +271,57 @@ void State::StopMonitoringTrackChange() {
 bool State::CreateResources() {
     for (auto i = tracks.begin(); i != tracks.end();) {
         Track& t = *i;
-        if (t.remove || t.reload) {
-            // Make sure async work is completed.
-            if (t.future_audio_buffer.valid())
-                t.future_audio_buffer.get();
-            if (t.future_lowres_waveform.valid())
-                t.future_lowres_waveform.get();
-            if (t.future_spectrogram.valid())
-                t.future_spectrogram.get();
-
-            // Remove track.
-            if (t.remove) {
-                tracks.erase(i++);
-                ResetView();
-                continue;
-            }
+        // Remove track. Its queued work is dropped and running work stops early.
+        if (t.remove) {
+            scheduler_.Cancel(*t.tasks);
+            tracks.erase(i++);
+            ResetView();
+            continue;
+        }
 
-            // Reload track.
-            if (t.reload) {
-                t.future_audio_buffer =
-                    std::async([&t] { return std::make_shared<AudioBuffer>(t.path); });
-                t.reload = false;
-            }
+        // Reload track, cancelling a load that is still in progress.
+        if (t.reload) {
+            scheduler_.Cancel(*t.load_tasks);
+            t.load_tasks = std::make_shared<TaskGroup>(t.tasks);
+            t.future_lowres_waveform = {};
+            t.future_audio_buffer = LoadAudioBuffer(scheduler_, t, decode_threads_);
+            t.reload = false;
+            t.evicted = false;
         }
         i++;
     }
+    UpdateTaskPriorities();
+    EnforceBudgets();
 
     bool resources_to_load = false;
     for (Track& t : tracks) {
-        resources_to_load =
-            resources_to_load || !t.audio_buffer || !t.gpu_waveform || !t.gpu_spectrogram;
+        resources_to_load = resources_to_load || (!t.audio_buffer && !t.evicted);
 
         // Asynchronous creation of audio buffer.
-        if (!t.audio_buffer && !t.future_audio_buffer.valid()) {
+        if (!t.audio_buffer && !t.future_audio_buffer.valid() && !t.evicted) {
             t.status = "Loading: " + t.path;
-            t.future_audio_buffer =
-                std::async([&t] { return std::make_shared<AudioBuffer>(t.path); });
+            t.future_audio_buffer = LoadAudioBuffer(scheduler_, t, decode_threads_);
             ResetView();
         }
 
-        // Check if new audio buffer is loaded.
+        // Check if new audio buffer is opened.
         if (t.future_audio_buffer.valid()) {
             resources_to_load = true;
             if (t.future_audio_buffer.wait_for(std::chrono::seconds(0)) ==
                 std::future_status::ready) {
                 t.audio_buffer = t.future_audio_buffer.get();
+                t.num_channels = t.audio_buffer->NumChannels();
+                t.samplerate = t.audio_buffer->Samplerate();
+                t.streamable = t.audio_buffer->Streamable();
+                t.loaded = false;
                 t.spectrogram.reset();
                 t.gpu_waveform.reset();
                 t.gpu_spectrogram.reset();
+                t.next_spectrogram.reset();
+                t.next_gpu_spectrogram.reset();
+                // A low-res waveform of the previous audio buffer is no longer needed.
+                t.lowres_waveform.reset();
+                t.future_lowres_waveform = {};
 
                 if (t.audio_buffer->NumChannels() == 0) {
                     t.status = "Failed to load: " + t.path;
@@ -217,56 +330,199 @@ bool State::CreateResources() {
             }
         }
 
-        // Create spectrogram.
-        if (!t.spectrogram && t.audio_buffer && !t.gpu_spectrogram) {
-            if (!t.future_spectrogram.valid()) {
-                // Asynchronous creation of spectrogram.
-                t.future_spectrogram = std::async([&t, &fftw_mutex = fftw_mutex_] {
-                    return std::make_unique<Spectrogram>(t.audio_buffer->Samples(),
-                                                         t.audio_buffer->NumChannels(),
-                                                         t.audio_buffer->NumFrames(), fftw_mutex);
-                });
-            } else {
-                // Check if spectrogram is ready.
-                if (t.future_spectrogram.wait_for(std::chrono::seconds(0)) ==
-                    std::future_status::ready) {
-                    t.spectrogram = t.future_spectrogram.get();
-                }
+        // The length of the file is final once it is loaded.
+        if (t.audio_buffer && !t.loaded) {
+            resources_to_load = true;
+            if (t.audio_buffer->Loaded()) {
+                t.loaded = true;
+                ResetView();
             }
         }
 
-        // Create GPU representation of waveform.
-        if (!t.gpu_waveform && t.audio_buffer) {
-            if (!t.future_lowres_waveform.valid()) {
-                // Asynchronous creation of low-res waveform.
-                t.future_lowres_waveform =
-                    std::async([&t] { return std::make_unique<LowResWaveform>(*t.audio_buffer); });
-            } else {
+        // Create spectrogram. Its tiles are computed in the background, starting with the view.
+        if (!t.spectrogram && t.audio_buffer && t.audio_buffer->NumChannels()) {
+            t.spectrogram =
+                std::make_unique<Spectrogram>(t.audio_buffer, spectrogram_settings, fft_plans_,
+                                              analysis_cache, scheduler_, t.tasks);
+        }
+        if (t.spectrogram && !t.gpu_spectrogram && !t.gpu_evicted) {
+            t.gpu_spectrogram =
+                std::make_unique<GpuSpectrogram>(*t.spectrogram, t.audio_buffer->Samplerate());
+        }
+
+        // Recompute the spectrogram when the settings have changed, or when the file turned out
+        // to be shorter than its header said. The current spectrogram is shown until the tiles in
+        // view are ready.
+        const Spectrogram* latest =
+            t.next_spectrogram ? t.next_spectrogram.get() : t.spectrogram.get();
+        if (latest && !t.gpu_evicted &&
+            (latest->Settings() != spectrogram_settings ||
+             (t.loaded && latest->NumFrames() != t.audio_buffer->NumFrames()))) {
+            t.next_spectrogram =
+                std::make_unique<Spectrogram>(t.audio_buffer, spectrogram_settings, fft_plans_,
+                                              analysis_cache, scheduler_, t.tasks);
+            t.next_gpu_spectrogram = std::make_unique<GpuSpectrogram>(
+                *t.next_spectrogram, t.audio_buffer->Samplerate());
+        }
+
+        // Asynchronous creation of low-res waveform, updated while the audio buffer is loaded.
+        if (t.audio_buffer && t.audio_buffer->NumChannels()) {
+            if (t.future_lowres_waveform.valid()) {
+                resources_to_load = true;
                 if (t.future_lowres_waveform.wait_for(std::chrono::seconds(0)) ==
                     std::future_status::ready) {
-                    std::unique_ptr<LowResWaveform> lowres_waveform =
-                        t.future_lowres_waveform.get();
-                    t.gpu_waveform = std::make_unique<GpuWaveform>(*t.audio_buffer,
-                                                                   lowres_waveform->GetBuffer());
-                    // Indicate that file is loaded.
-                    if (t.audio_buffer->NumChannels()) {
-                        t.status = "";
-                    }
+                    t.lowres_waveform = t.future_lowres_waveform.get();
                 }
+            } else if (!t.lowres_waveform ||
+                       (!t.lowres_waveform->Complete() &&
+                        (t.audio_buffer->Loaded() ||
+                         t.audio_buffer->LoadedFrames() > t.lowres_waveform->ComputedFrames()))) {
+                t.future_lowres_waveform = UpdateLowResWaveform(scheduler_, t, analysis_cache);
             }
         }
 
-        // Create GPU representation of spectrogram.
-        if (!t.gpu_spectrogram && t.spectrogram) {
-            t.gpu_spectrogram =
-                std::make_unique<GpuSpectrogram>(*t.spectrogram, t.audio_buffer->Samplerate());
-            t.spectrogram.reset();
+        // Create GPU representation of waveform.
+        if (t.lowres_waveform && !t.gpu_evicted && !t.gpu_waveform) {
+            t.gpu_waveform = std::make_unique<GpuWaveform>(*t.audio_buffer, *t.lowres_waveform);
+            // Indicate that file is shown.
+            t.status = "";
+        }
+    }
+
+    // Upload within the budget of the frame, tracks in view first.
+    upload_budget_.NewFrame();
+    for (const bool in_view : {true, false}) {
+        int number = 0;
+        for (Track& t : tracks) {
+            if (InView(number++) == in_view && Upload(t)) {
+                resources_to_load = true;
+            }
         }
     }
 
     return resources_to_load;
 }
 
+bool State::Upload(Track& t) {
+    bool pending = false;
+    if (t.next_gpu_spectrogram) {
+        pending = true;
+        if (!t.next_gpu_spectrogram->Update(*t.next_spectrogram, zoom_window.Left(),
+                                            zoom_window.Right(), upload_budget_)) {
+            t.gpu_spectrogram = std::move(t.next_gpu_spectrogram);
+            t.spectrogram = std::move(t.next_spectrogram);
+        }
+    }
+
+    // Upload what is loaded of the waveform.
+    if (t.gpu_waveform && t.gpu_waveform->Update(*t.audio_buffer, *t.lowres_waveform,
+                                                 zoom_window.Left(), zoom_window.Right(),
+                                                 upload_budget_)) {
+        pending = true;
+    }
+
+    // Upload spectrogram tiles as they are computed.
+    if (t.gpu_spectrogram && t.gpu_spectrogram->Update(*t.spectrogram, zoom_window.Left(),
+                                                       zoom_window.Right(), upload_budget_)) {
+        pending = true;
+    }
+    return pending;
+}
+
+void State::UpdateTaskPriorities() {
+    int number = 0;
+    for (Track& t : tracks) {
+        if (selected_track && number == *selected_track) {
+            t.tasks->SetPriority(SELECTED);
+        } else if (InView(number)) {
+            t.tasks->SetPriority(VISIBLE);
+        } else {
+            t.tasks->SetPriority(HIDDEN);
+        }
+        number++;
+    }
+}
+
+void State::EnforceBudgets() {
+    frame_++;
+    std::vector<ResourceManager::Resident> residents;
+    int number = 0;
+    for (Track& t : tracks) {
+        const bool in_view = InView(number);
+        const bool selected = selected_track && number == *selected_track;
+        number++;
+        if (in_view) {
+            t.last_viewed = frame_;
+            t.evicted = false;
+            t.gpu_evicted = false;
+        }
+
+        ResourceManager::Resident r = MemoryOf(t);
+        r.last_viewed = t.last_viewed;
+        // Playback reads the samples of the playing tracks that cannot be streamed. The others are
+        // streamed from their files.
+        r.pinned =
+            in_view || selected || (t.audio_buffer && audio->UsesSamples(t.audio_buffer.get()));
+        residents.push_back(r);
+    }
+
+    // Spectrogram tiles outside of the view are evicted before whole tracks. A replacement
+    // spectrogram comes first, since it is the one that stays.
+    const std::vector<ResourceManager::TileBudget> tile_budgets = resources_.TileBudgets(residents);
+    number = 0;
+    for (Track& t : tracks) {
+        size_t cpu_budget = tile_budgets[number].cpu_bytes;
+        for (Spectrogram* spectrogram : {t.next_spectrogram.get(), t.spectrogram.get()}) {
+            if (spectrogram) {
+                spectrogram->SetMemoryBudget(cpu_budget);
+                cpu_budget -= std::min(cpu_budget, spectrogram->MemoryUsage());
+            }
+        }
+        size_t gpu_budget = tile_budgets[number].gpu_bytes;
+        for (GpuSpectrogram* gpu_spectrogram :
+             {t.next_gpu_spectrogram.get(), t.gpu_spectrogram.get()}) {
+            if (gpu_spectrogram) {
+                gpu_spectrogram->SetMemoryBudget(gpu_budget);
+                gpu_budget -= std::min(gpu_budget, gpu_spectrogram->MemoryUsage());
+            }
+        }
+        // Without the evicted tiles.
+        const ResourceManager::Resident memory = MemoryOf(t);
+        residents[number].cpu_bytes = memory.cpu_bytes;
+        residents[number].gpu_bytes = memory.gpu_bytes;
+        number++;
+    }
+
+    const std::vector<ResourceManager::Eviction> evictions = resources_.Plan(residents);
+    number = 0;
+    for (Track& t : tracks) {
+        switch (evictions[number++]) {
+            case ResourceManager::EVICT_ALL:
+                // Like a reload that waits until the track is in view.
+                scheduler_.Cancel(*t.load_tasks);
+                t.load_tasks = std::make_shared<TaskGroup>(t.tasks);
+                t.duration = t.audio_buffer ? t.audio_buffer->Duration() : t.duration;
+                t.audio_buffer.reset();
+                t.future_audio_buffer = {};
+                t.lowres_waveform.reset();
+                t.future_lowres_waveform = {};
+                t.spectrogram.reset();
+                t.evicted = true;
+                [[fallthrough]];
+            case ResourceManager::EVICT_GPU:
+                t.gpu_waveform.reset();
+                t.gpu_spectrogram.reset();
+                // A pending change of settings is redone when the track is in view again.
+                t.next_spectrogram.reset();
+                t.next_gpu_spectrogram.reset();
+                t.gpu_evicted = true;
+                break;
+            case ResourceManager::KEEP:
+                break;
+        }
+    }
+}
+
 void State::SetLooping(bool do_loop) {
     audio->SetLooping(do_loop);
 }
@@ -274,20 +530,118 @@ void State::SetLooping(bool do_loop) {
 void State::TogglePlayback() {
     if (SelectedTrack()) {
         Track& t = GetTrack(*selected_track);
-        if (t.audio_buffer) {
-            std::unique_ptr<AudioMixer> mixer = std::make_unique<AudioMixer>(
-                t.audio_buffer->NumChannels(), audio->NumOutputChannels());
-            if (t.selected_channel) {
-                mixer->Solo(*t.selected_channel);
-            }
-            mixer->Gain(zoom_window.VerticalZoom());
-            audio->TogglePlayback(t.audio_buffer, std::move(mixer), Cursor(), Selection());
+        if (std::optional<AudioSystem::Input> input = NewInput(t)) {
+            audio->TogglePlayback(std::move(*input), Cursor(), Selection());
             last_played_track = *selected_track;
         }
     }
 }
 
-bool State::Playing(float* time) {
+void State::TogglePlaybackOfAll() {
+    double time;
+    if (audio->Playing(&time)) {
+        audio->Stop();
+        return;
+    }
+    // Tracks that are evicted from memory are streamed from their files, where the format allows.
+    std::vector<AudioSystem::Input> inputs;
+    for (const Track& t : tracks) {
+        if (std::optional<AudioSystem::Input> input = NewInput(t)) {
+            input->offset = t.offset;
+            input->gain = MixGain(t);
+            inputs.push_back(std::move(*input));
+        }
+    }
+    audio->PlayMix(std::move(inputs), Cursor(), Selection());
+}
+
+void State::ToggleMute() {
+    if (SelectedTrack()) {
+        GetSelectedTrack().muted = !GetSelectedTrack().muted;
+        UpdateMixGains();
+    }
+}
+
+void State::ToggleSolo() {
+    if (SelectedTrack()) {
+        GetSelectedTrack().soloed = !GetSelectedTrack().soloed;
+        UpdateMixGains();
+    }
+}
+
+void State::ChangeGain(float db) {
+    if (SelectedTrack()) {
+        GetSelectedTrack().gain_db += db;
+        UpdateMixGains();
+    }
+}
+
+void State::CycleOutputChannel() {
+    if (SelectedTrack()) {
+        std::optional<int>& output_channel = GetSelectedTrack().output_channel;
+        if (!output_channel) {
+            output_channel = 0;
+        } else if (*output_channel + 1 < audio->NumOutputChannels()) {
+            ++*output_channel;
+        } else {
+            output_channel.reset();
+        }
+    }
+}
+
+void State::UpdateMixGains() {
+    for (const Track& t : tracks) {
+        audio->SetGain(t.id, MixGain(t));
+    }
+}
+
+float State::MixGain(const Track& t) const {
+    // When any track is soloed, only soloed tracks are heard.
+    const bool any_soloed =
+        std::any_of(tracks.begin(), tracks.end(), [](const Track& t) { return t.soloed; });
+    return t.muted || (any_soloed && !t.soloed) ? 0.f : DbToGain(t.gain_db);
+}
+
+void State::SwitchPlayback() {
+    if (SelectedTrack()) {
+        Track& t = GetTrack(*selected_track);
+        std::optional<AudioSystem::Input> input = NewInput(t);
+        if (input && audio->Switch(std::move(*input))) {
+            last_played_track = *selected_track;
+        }
+    }
+}
+
+std::optional<AudioSystem::Input> State::NewInput(const Track& t) {
+    if (!t.num_channels || (!t.audio_buffer && !(t.evicted && t.streamable)))
+        return std::nullopt;
+    AudioSystem::Input input;
+    input.id = t.id;
+    input.buffer = t.audio_buffer;
+    input.file_name = t.path;
+    input.num_channels = t.num_channels;
+    input.samplerate = t.samplerate;
+    input.duration = t.audio_buffer ? t.audio_buffer->Duration() : t.duration;
+    input.mixer = NewMixer(t);
+    input.gain = DbToGain(t.gain_db);
+    return input;
+}
+
+std::unique_ptr<AudioMixer> State::NewMixer(const Track& t) {
+    std::unique_ptr<AudioMixer> mixer =
+        std::make_unique<AudioMixer>(t.num_channels, audio->NumOutputChannels());
+    if (t.selected_channel) {
+        mixer->Solo(*t.selected_channel);
+    }
+    // A list of files can name an output channel that the device does not have.
+    if (t.output_channel && *t.output_channel < mixer->NumOutputChannels()) {
+        mixer->Route(*t.output_channel);
+    }
+    mixer->Gain(zoom_window.VerticalZoom());
+    return mixer;
+}
+
+bool State::Playing(double* time) {
     return audio->Playing(time);
 }
 
@@ -317,9 +671,9 @@ Track& State::GetSelectedTrack() {
 
 void State::ResetView() {
     // Remember zoom time interval before reset.
-    const float view_start = zoom_window.Left();
-    const float view_end = zoom_window.Right();
-    const bool restore_view = view_start != 0.f || view_end != zoom_window.MaxX();
+    const double view_start = zoom_window.Left();
+    const double view_end = zoom_window.Right();
+    const bool restore_view = view_start != 0.0 || view_end != zoom_window.MaxX();
 
     // Make sure selected_track dows not exceed its maximum value.
     if (selected_track && tracks.size()) {
@@ -340,7 +694,7 @@ void State::ResetView() {
     zoom_window.Reset();
     if (tracks.size()) {
         for (Track& t : tracks) {
-            float length = t.audio_buffer ? t.audio_buffer->Duration() : 0.f;
+            double length = t.audio_buffer ? t.audio_buffer->Duration() : t.duration;
             zoom_window.LoadFile(length);
         }
     }
@@ -1,19 +1,25 @@
 #ifndef STATE_HPP
 #define STATE_HPP
 
+#include <functional>
 #include <future>
 #include <list>
 #include <memory>
 #include <optional>
 
+#include "analysis_cache.hpp"
 #include "audio_buffer.hpp"
 #include "audio_system.hpp"
+#include "fft_plans.hpp"
 #include "file_load_server.hpp"
 #include "file_notification.hpp"
 #include "gpu_spectrogram.hpp"
 #include "gpu_waveform.hpp"
 #include "low_res_waveform.hpp"
+#include "resource_manager.hpp"
 #include "spectrogram.hpp"
+#include "task_scheduler.hpp"
+#include "upload_budget.hpp"
 #include "zoom_window.hpp"
 
 struct Track {
@@ -26,35 +32,100 @@ struct Track {
     std::unique_ptr<Spectrogram> spectrogram;
     std::unique_ptr<GpuWaveform> gpu_waveform;
     std::unique_ptr<GpuSpectrogram> gpu_spectrogram;
+    // Spectrogram with new settings, replacing the current one when the tiles in view are ready.
+    std::unique_ptr<Spectrogram> next_spectrogram;
+    std::unique_ptr<GpuSpectrogram> next_gpu_spectrogram;
+    // The audio buffer arrives as soon as the file is opened and is loaded in the background.
     std::future<std::shared_ptr<AudioBuffer>> future_audio_buffer;
-    std::future<std::unique_ptr<LowResWaveform>> future_lowres_waveform;
-    std::future<std::unique_ptr<Spectrogram>> future_spectrogram;
+    bool loaded = false;
+    // The low-res waveform follows the loading of the audio buffer, one update at a time.
+    std::shared_ptr<LowResWaveform> lowres_waveform;
+    std::future<std::shared_ptr<LowResWaveform>> future_lowres_waveform;
+    // All work of the track, with the priority of the track. Loading of the audio buffer and the
+    // low-res waveform is in a child group that is replaced when the file is reloaded.
+    std::shared_ptr<TaskGroup> tasks = std::make_shared<TaskGroup>();
+    std::shared_ptr<TaskGroup> load_tasks = std::make_shared<TaskGroup>(tasks);
+    // Frame when the track was last in view, for evicting the least recently viewed tracks.
+    uint64_t last_viewed = 0;
+    // Resources that are evicted to stay within budget, rebuilt when the track is in view again.
+    // An evicted track keeps its length, so that the view does not change, and its format, so
+    // that it can still be played from its file.
+    bool evicted = false;
+    bool gpu_evicted = false;
+    double duration = 0.0;
+    int num_channels = 0;
+    int samplerate = 0;
+    bool streamable = false;
     bool reload = false;
     bool remove = false;
     std::optional<int> watch_id_;
     int GetSamplerate() const { return audio_buffer ? audio_buffer->Samplerate() : 0; }
     void Reload();
     std::optional<int> selected_channel;
+    // Mixing of all tracks. The offset in seconds is from the list of files. The id identifies the
+    // track in a playback, which can outlive its audio buffer.
+    int id = 0;
+    bool muted = false;
+    bool soloed = false;
+    double offset = 0.0;
+    // Gain in dB, and the output channel that all channels are routed to instead of the default
+    // routing. Both are from the list of files or changed with the keyboard.
+    float gain_db = 0.f;
+    std::optional<int> output_channel;
 };
 
 enum ViewMode { ALL, TRACK };
 
 class State {
    public:
-    State(AudioSystem* audio, std::mutex& fftw_mutex)
+    // Tasks may outlive the state, so what they use is owned by the caller. Compressed files are
+    // decoded by up to |decode_threads| workers each, or by all workers if 0. |wake_up| is called
+    // from other threads when files are added or modified, so that the view can be redrawn.
+    State(AudioSystem* audio,
+          const AnalysisCache& analysis_cache,
+          FftPlans& fft_plans,
+          TaskScheduler& scheduler,
+          ResourceManager& resources,
+          int decode_threads = 0,
+          std::function<void()> wake_up = [] {})
         : audio(audio),
-          file_load_server([this](const std::string& file_name) { this->LoadFile(file_name); }),
-          fftw_mutex_(fftw_mutex) {}
-    void LoadFile(const std::string& file_name, std::optional<std::string> label = std::nullopt);
+          wake_up_(std::move(wake_up)),
+          file_load_server([this](const std::string& file_name) {
+              this->LoadFile(file_name);
+              wake_up_();
+          }),
+          analysis_cache(analysis_cache),
+          fft_plans_(fft_plans),
+          scheduler_(scheduler),
+          resources_(resources),
+          decode_threads_(decode_threads) {}
+    void LoadFile(const std::string& file_name,
+                  std::optional<std::string> label = std::nullopt,
+                  double offset = 0.0,
+                  float gain_db = 0.f,
+                  std::optional<int> output_channel = std::nullopt);
     void UnloadFiles();
     void UnloadSelectedTrack();
     void ReloadFiles();
     bool CreateResources();
     void SetLooping(bool do_loop);
     void TogglePlayback();
-    bool Playing(float* time);
-    float Cursor() { return cursor; }
-    void SetCursor(float time) {
+    // Play the mix of all tracks, with their offsets and mute and solo states.
+    void TogglePlaybackOfAll();
+    // Mute or solo the selected track, also while the mix is playing.
+    void ToggleMute();
+    void ToggleSolo();
+    // Change the gain of the selected track by |db|, also while it plays.
+    void ChangeGain(float db);
+    // Route the selected track to the next output channel, or back to all of them after the last.
+    // Takes effect from the next playback.
+    void CycleOutputChannel();
+    // Continue playback with the selected track from the same position, for A/B comparisons of
+    // time-aligned tracks. Does nothing when not playing.
+    void SwitchPlayback();
+    bool Playing(double* time);
+    double Cursor() { return cursor; }
+    void SetCursor(double time) {
         cursor = time;
         selection.reset();
     }
@@ -65,14 +136,19 @@ class State {
             }
         }
     }
-    std::optional<float> Selection() { return selection; }
-    void SetSelection(float time) { selection = time; }
+    std::optional<double> Selection() { return selection; }
+    void SetSelection(double time) { selection = time; }
     std::optional<int> SelectedTrack() { return selected_track; }
     bool SetSelectedTrack(int track);
     Track& GetTrack(int number);
     Track& GetSelectedTrack();
     void ResetView();
     int GetCurrentSamplerate();
+    const SpectrogramSettings& GetSpectrogramSettings() const { return spectrogram_settings; }
+    // Tracks pick up new settings in CreateResources().
+    void SetSpectrogramSettings(const SpectrogramSettings& settings) {
+        spectrogram_settings = settings;
+    }
     void ToggleViewSingleTrack();
     void ToggleViewSingleChannel(float mouse_y);
     ViewMode GetViewMode() { return view_mode; }
@@ -96,19 +172,50 @@ class State {
    private:
     void LoadListOfFiles(const std::string& file_name);
 
+    // Prioritize the work of the selected track, then the tracks in view.
+    void UpdateTaskPriorities();
+    bool InView(int track) const {
+        return track + 1 > zoom_window.Top() && track < zoom_window.Bottom();
+    }
+    // Evict resources of tracks out of view when over budget, and let tracks in view rebuild
+    // theirs.
+    void EnforceBudgets();
+    // Upload the new GPU resources of a track within the budget of the frame. Returns true while
+    // there is more to upload.
+    bool Upload(Track& t);
+
     void MonitorTrack(Track& t);
     void UnmonitorTrack(Track& t);
+    // Playback input of |t|, from its audio buffer or its file. Empty if the file is not opened
+    // yet or failed to open.
+    std::optional<AudioSystem::Input> NewInput(const Track& t);
+    // Mixer of |t| to the output channels, with the solo channel, the output channel and vertical
+    // zoom as gain.
+    std::unique_ptr<AudioMixer> NewMixer(const Track& t);
+    // Gain of |t| in the mix of all tracks, with its own gain.
+    float MixGain(const Track& t) const;
+    void UpdateMixGains();
 
     AudioSystem* audio;
     int next_id = 0;
-    float cursor = 0.f;
-    std::optional<float> selection;
+    double cursor = 0.0;
+    std::optional<double> selection;
     std::optional<int> selected_track;
+    SpectrogramSettings spectrogram_settings;
 
     std::unique_ptr<FileModificationNotifier> track_change_notifier_;
+    // Initialized before the threads that call it.
+    const std::function<void()> wake_up_;
     FileLoadServer file_load_server;
+    const AnalysisCache& analysis_cache;
 
-    std::mutex& fftw_mutex_;
+    FftPlans& fft_plans_;
+    TaskScheduler& scheduler_;
+    ResourceManager& resources_;
+    const int decode_threads_;
+    uint64_t frame_ = 0;
+    // Uploads beyond this many bytes per frame wait for the next frame.
+    UploadBudget upload_budget_{16 << 20};
 };
 
 #endif
@@ -0,0 +1,180 @@
+#include "task_scheduler.hpp"
+#include <algorithm>
+#include <iterator>
+#include <tuple>
+
+namespace {
+// The scheduler and worker index of the current thread, if it is a worker.
+thread_local TaskScheduler* current_scheduler = nullptr;
+thread_local int current_worker = -1;
+
+// Progress of a ParallelFor() call. Indices are handed out one at a time, so a part that is
+// stolen late finds nothing left to do.
+struct Batch {
+    std::atomic<int64_t> next{0};
+    std::atomic<int64_t> done{0};
+    std::mutex mutex;
+    std::condition_variable condition;
+};
+}  // namespace
+
+TaskScheduler::TaskScheduler(int num_threads) {
+    if (num_threads <= 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (int i = 0; i < num_threads; i++) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    for (int i = 0; i < num_threads; i++) {
+        workers[i]->thread = std::thread(&TaskScheduler::Run, this, i);
+    }
+}
+
+TaskScheduler::~TaskScheduler() {
+    std::vector<Task> dropped;
+    {
+        std::scoped_lock lock(mutex);
+        stop = true;
+        dropped.swap(queue);
+    }
+    condition.notify_all();
+    for (std::unique_ptr<Worker>& worker : workers) {
+        worker->thread.join();
+    }
+}
+
+int TaskScheduler::QueueDepth() const {
+    std::scoped_lock lock(mutex);
+    return queue.size() + num_running;
+}
+
+void TaskScheduler::Post(std::shared_ptr<const TaskGroup> group,
+                         std::function<void()> function,
+                         bool background) {
+    {
+        std::scoped_lock lock(mutex);
+        queue.push_back({std::move(group), std::move(function), background, next_sequence++});
+    }
+    condition.notify_one();
+}
+
+void TaskScheduler::Cancel(TaskGroup& group) {
+    group.cancelled = true;
+
+    // Dropped tasks are destroyed without the lock held, since that breaks their futures.
+    std::vector<Task> dropped;
+    {
+        std::scoped_lock lock(mutex);
+        auto cancelled = std::stable_partition(queue.begin(), queue.end(), [](const Task& task) {
+            return !task.group->Cancelled();
+        });
+        std::move(cancelled, queue.end(), std::back_inserter(dropped));
+        queue.erase(cancelled, queue.end());
+    }
+}
+
+void TaskScheduler::Run(int index) {
+    current_scheduler = this;
+    current_worker = index;
+
+    std::unique_lock lock(mutex);
+    while (true) {
+        // Parts of tasks that are already running come first.
+        std::function<void()> part;
+        if (num_parts > 0) {
+            lock.unlock();
+            if (PopPart(index, &part)) {
+                part();
+            }
+            lock.lock();
+            continue;
+        }
+        if (stop)
+            return;
+        if (queue.empty()) {
+            condition.wait(lock);
+            continue;
+        }
+
+        // Foreground tasks before background tasks, then by priority and in order of submission.
+        auto next = std::min_element(queue.begin(), queue.end(), [](const Task& a, const Task& b) {
+            return std::make_tuple(a.background, a.group->Priority(), a.sequence) <
+                   std::make_tuple(b.background, b.group->Priority(), b.sequence);
+        });
+        Task task = std::move(*next);
+        queue.erase(next);
+        num_running++;
+        lock.unlock();
+        if (!task.group->Cancelled()) {
+            task.function();
+        }
+        task = {};
+        lock.lock();
+        num_running--;
+    }
+}
+
+bool TaskScheduler::PopPart(int index, std::function<void()>* part) {
+    const int num_workers = workers.size();
+    for (int i = 0; i < num_workers; i++) {
+        Worker& worker = *workers[(index + i) % num_workers];
+        std::scoped_lock lock(worker.mutex);
+        if (worker.parts.empty())
+            continue;
+        // The owner takes the most recent part, thieves take the oldest.
+        if (i == 0) {
+            *part = std::move(worker.parts.back());
+            worker.parts.pop_back();
+        } else {
+            *part = std::move(worker.parts.front());
+            worker.parts.pop_front();
+        }
+        num_parts--;
+        return true;
+    }
+    return false;
+}
+
+void TaskScheduler::PushParts(int index, const std::function<void()>& part, int count) {
+    {
+        Worker& worker = *workers[index];
+        std::scoped_lock lock(worker.mutex);
+        worker.parts.insert(worker.parts.end(), count, part);
+    }
+    // Count the parts with the lock held, so that a worker that is about to wait sees them.
+    {
+        std::scoped_lock lock(mutex);
+        num_parts += count;
+    }
+    condition.notify_all();
+}
+
+void TaskScheduler::ParallelFor(int64_t count, const std::function<void(int64_t)>& function) {
+    TaskScheduler* scheduler = current_scheduler;
+    const int64_t num_parts = scheduler ? std::min<int64_t>(count, scheduler->NumThreads()) : 1;
+    if (num_parts <= 1) {
+        for (int64_t i = 0; i < count; i++) {
+            function(i);
+        }
+        return;
+    }
+
+    auto batch = std::make_shared<Batch>();
+    auto part = [batch, count, &function] {
+        int64_t done = 0;
+        for (int64_t i = batch->next++; i < count; i = batch->next++) {
+            function(i);
+            done++;
+        }
+        if (done && (batch->done += done) == count) {
+            std::scoped_lock lock(batch->mutex);
+            batch->condition.notify_one();
+        }
+    };
+    // |function| is only referenced by parts that find indices left, which are waited for below.
+    scheduler->PushParts(current_worker, part, num_parts - 1);
+    part();
+
+    std::unique_lock lock(batch->mutex);
+    batch->condition.wait(lock, [&] { return batch->done == count; });
+}
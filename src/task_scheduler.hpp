@@ -0,0 +1,124 @@
+#ifndef TASK_SCHEDULER_HPP
+#define TASK_SCHEDULER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Tasks with a lower priority value run first.
+enum TaskPriority { SELECTED, VISIBLE, HIDDEN };
+
+// Tasks that belong together, e.g. the loading of one track. A group with a parent follows the
+// priority of the parent and is cancelled together with it.
+class TaskGroup {
+   public:
+    explicit TaskGroup(std::shared_ptr<const TaskGroup> parent = nullptr)
+        : parent(std::move(parent)) {}
+    TaskPriority Priority() const { return parent ? parent->Priority() : priority.load(); }
+    void SetPriority(TaskPriority new_priority) { priority = new_priority; }
+    bool Cancelled() const { return cancelled || (parent && parent->Cancelled()); }
+
+   private:
+    friend class TaskScheduler;
+
+    const std::shared_ptr<const TaskGroup> parent;
+    std::atomic<TaskPriority> priority{HIDDEN};
+    std::atomic<bool> cancelled{false};
+};
+
+// Lets long-running work stop early when its group is cancelled. A default token is never
+// cancelled.
+class CancellationToken {
+   public:
+    CancellationToken() = default;
+    explicit CancellationToken(std::shared_ptr<const TaskGroup> group) : group(std::move(group)) {}
+    bool Cancelled() const { return group && group->Cancelled(); }
+
+   private:
+    std::shared_ptr<const TaskGroup> group;
+};
+
+// A fixed number of worker threads shared by all loading and analysis work. Tasks are queued with
+// a group and run in order of group priority. ParallelFor() splits work within a task; its parts
+// are queued on the deque of the calling worker and stolen by idle workers.
+class TaskScheduler {
+   public:
+    // One thread per hardware thread if |num_threads| is 0.
+    explicit TaskScheduler(int num_threads);
+    // Queued tasks are dropped and running tasks are completed.
+    ~TaskScheduler();
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    int NumThreads() const { return workers.size(); }
+    // Number of tasks that are queued or running, not counting the parts of ParallelFor().
+    int QueueDepth() const;
+
+    // Queue |function| in |group|. Background tasks run after all other tasks, regardless of the
+    // group priority. The future is broken if the task is dropped because the group is cancelled.
+    template <class F>
+    auto Submit(std::shared_ptr<const TaskGroup> group, F function, bool background = false)
+        -> std::future<decltype(function())>;
+    // Mark |group| and its children as cancelled and drop their queued tasks. Running tasks stop
+    // when they next check their CancellationToken.
+    void Cancel(TaskGroup& group);
+
+    // Call |function| for each index in [0, count) and return when all calls are done. When called
+    // from a task, the calls are spread over the workers. Otherwise they are made in order on the
+    // calling thread.
+    static void ParallelFor(int64_t count, const std::function<void(int64_t)>& function);
+
+   private:
+    struct Task {
+        std::shared_ptr<const TaskGroup> group;
+        std::function<void()> function;
+        bool background;
+        uint64_t sequence;
+    };
+
+    // Parts of ParallelFor() calls, pushed and popped at the back by the owner and stolen from the
+    // front by other workers.
+    struct Worker {
+        std::mutex mutex;
+        std::deque<std::function<void()>> parts;
+        std::thread thread;
+    };
+
+    void Post(std::shared_ptr<const TaskGroup> group,
+              std::function<void()> function,
+              bool background);
+    void Run(int index);
+    // Pop a part from the deque of worker |index|, or steal one from another worker.
+    bool PopPart(int index, std::function<void()>* part);
+    void PushParts(int index, const std::function<void()>& part, int count);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    // Number of parts in the deques of all workers.
+    std::atomic<int> num_parts{0};
+
+    mutable std::mutex mutex;
+    std::condition_variable condition;
+    std::vector<Task> queue;
+    uint64_t next_sequence = 0;
+    int num_running = 0;
+    bool stop = false;
+};
+
+template <class F>
+auto TaskScheduler::Submit(std::shared_ptr<const TaskGroup> group, F function, bool background)
+    -> std::future<decltype(function())> {
+    // std::function needs a copyable target.
+    auto task = std::make_shared<std::packaged_task<decltype(function())()>>(std::move(function));
+    auto future = task->get_future();
+    Post(std::move(group), [task] { (*task)(); }, background);
+    return future;
+}
+
+#endif
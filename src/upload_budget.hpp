@@ -0,0 +1,31 @@
+#ifndef UPLOAD_BUDGET_HPP
+#define UPLOAD_BUDGET_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// Bytes that may be uploaded to the GPU in one frame. The budget is shared by the GPU objects of
+// all tracks, so that uploading a large file is spread over several frames instead of stalling
+// one of them.
+class UploadBudget {
+   public:
+    explicit UploadBudget(size_t bytes_per_frame) : bytes_per_frame(bytes_per_frame) {}
+    void NewFrame() { remaining = bytes_per_frame; }
+    bool Exhausted() const { return remaining == 0; }
+    // Take up to |units| units of |unit_size| bytes. Returns the number of units taken, which is
+    // zero when less than a unit remains.
+    int64_t Take(int64_t units, size_t unit_size) {
+        const int64_t taken = std::min<int64_t>(units, remaining / unit_size);
+        if (taken <= 0)
+            return 0;
+        remaining -= taken * unit_size;
+        return taken;
+    }
+
+   private:
+    const size_t bytes_per_frame;
+    size_t remaining = 0;
+};
+
+#endif
@@ -2,25 +2,25 @@
 #include <algorithm>
 #include <cmath>
 
-void ZoomWindow::LoadFile(float length) {
+void ZoomWindow::LoadFile(double length) {
     x_max = std::max(x_max, length);
     y_max += 1.f;
-    x_left = 0.f;
+    x_left = 0.0;
     x_right = x_max;
     y_top = 0.f;
     y_bottom = y_max;
 }
 
-void ZoomWindow::Zoom(float x, float factor) {
-    float zoom_level = x_right - x_left;
-    if (zoom_level <= 0.f)
+void ZoomWindow::Zoom(float x, double factor) {
+    double zoom_level = x_right - x_left;
+    if (zoom_level <= 0.0)
         return;
-    factor = std::max(factor, 0.001f / zoom_level);
-    float focus = x_left + zoom_level * x;
+    factor = std::max(factor, 0.001 / zoom_level);
+    double focus = x_left + zoom_level * x;
     x_left = focus - zoom_level * factor * x;
-    x_right = focus + zoom_level * factor * (1.f - x);
+    x_right = focus + zoom_level * factor * (1.0 - x);
 
-    x_left = std::max(x_left, 0.f);
+    x_left = std::max(x_left, 0.0);
     x_right = std::min(x_right, x_max);
 }
 
@@ -65,29 +65,29 @@ bool ZoomWindow::ShowingAllTracks() const {
     return y_top == 0.f && y_bottom == y_max;
 }
 
-void ZoomWindow::PanTo(float time) {
-    const float zoom_level = x_right - x_left;
+void ZoomWindow::PanTo(double time) {
+    const double zoom_level = x_right - x_left;
     x_left = time;
     x_right = time + zoom_level;
 }
 
 void ZoomWindow::PanLeft() {
-    const float view_length = x_right - x_left;
-    const float scroll_max = x_max - view_length;
-    const float scroll_increment = std::max(0.1f * view_length, 0.001f);
-    x_left = std::max(0.0f, std::min(scroll_max, x_left - scroll_increment));
+    const double view_length = x_right - x_left;
+    const double scroll_max = x_max - view_length;
+    const double scroll_increment = std::max(0.1 * view_length, 0.001);
+    x_left = std::max(0.0, std::min(scroll_max, x_left - scroll_increment));
     x_right = x_left + view_length;
 }
 
 void ZoomWindow::PanRight() {
-    const float view_length = x_right - x_left;
-    const float scroll_max = x_max - view_length;
-    const float scroll_increment = std::max(0.1f * view_length, 0.001f);
-    x_left = std::max(0.0f, std::min(scroll_max, x_left + scroll_increment));
+    const double view_length = x_right - x_left;
+    const double scroll_max = x_max - view_length;
+    const double scroll_increment = std::max(0.1 * view_length, 0.001);
+    x_left = std::max(0.0, std::min(scroll_max, x_left + scroll_increment));
     x_right = x_left + view_length;
 }
 
-float ZoomWindow::GetTime(float x) const {
+double ZoomWindow::GetTime(float x) const {
     return x_left + x * (x_right - x_left);
 }
 
@@ -102,9 +102,9 @@ int ZoomWindow::GetChannel(float y, int num_channels) const {
 }
 
 void ZoomWindow::Reset() {
-    x_left = 0.f;
-    x_right = 0.f;
-    x_max = 0.f;
+    x_left = 0.0;
+    x_right = 0.0;
+    x_max = 0.0;
     y_top = 0.f;
     y_bottom = 0.f;
     y_max = 0.f;
@@ -6,18 +6,18 @@
 
 class ZoomWindow {
    public:
-    void LoadFile(float length);
+    void LoadFile(double length);
     void ZoomIn(float x) { Zoom(x, 0.75f); }
     void ZoomOut(float x) { Zoom(x, 1.f / 0.75f); }
     void ZoomOutFull() {
-        x_left = 0.f;
+        x_left = 0.0;
         x_right = x_max;
     }
-    void ZoomRange(float start, float end) {
+    void ZoomRange(double start, double end) {
         if (start > end) {
             std::swap(start, end);
         }
-        x_left = std::max(start, 0.f);
+        x_left = std::max(start, 0.0);
         x_right = std::min(end, x_max);
     }
     void ZoomInVertical();
@@ -29,15 +29,15 @@ class ZoomWindow {
     void ShowSingleTrack(std::optional<int> track);
     void ShowSingleChannel(int track, int channel, int num_channels);
     bool ShowingAllTracks() const;
-    void PanTo(float time);
+    void PanTo(double time);
     void PanLeft();
     void PanRight();
-    float Left() const { return x_left; }
-    float Right() const { return x_right; }
+    double Left() const { return x_left; }
+    double Right() const { return x_right; }
     float Top() const { return y_top; }
     float Bottom() const { return y_bottom; }
-    float MaxX() const { return x_max; }
-    float GetTime(float x) const;
+    double MaxX() const { return x_max; }
+    double GetTime(float x) const;
     int GetTrack(float y) const;
     int GetChannel(float y, int num_channels) const;
     float VerticalZoom() const { return vertical_zoom; }
@@ -46,10 +46,11 @@ class ZoomWindow {
     void ToggleDbVerticalScale() { db_vertical_scale = !db_vertical_scale; };
 
    private:
-    void Zoom(float x, float factor);
-    float x_left = 0.f;
-    float x_right = 0.f;
-    float x_max = 0.f;
+    void Zoom(float x, double factor);
+    // Time axis in seconds. Double precision keeps single samples apart in long recordings.
+    double x_left = 0.0;
+    double x_right = 0.0;
+    double x_max = 0.0;
     float y_top = 0.f;
     float y_bottom = 0.f;
     float y_max = 0.f;
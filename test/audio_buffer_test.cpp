@@ -0,0 +1,210 @@
+// A FLAC file decoded in parallel chunks must give the same samples as a sequential decode, with
+// the loaded frames only growing while it loads, also when decoders cannot seek. 8 and 16-bit files
+// must be kept as 16-bit samples and read back as libsndfile reads them.
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sndfile.hh>
+#include <string>
+#include <vector>
+
+#include "audio_buffer.hpp"
+#include "task_scheduler.hpp"
+
+namespace {
+// Exit status that tells meson that the test was skipped.
+constexpr int kSkipped = 77;
+
+int status = 0;
+
+void Check(bool condition, const char* what) {
+    if (!condition) {
+        std::fprintf(stderr, "failed: %s\n", what);
+        status = 1;
+    }
+}
+
+std::string TempPath(const char* name) {
+    return std::filesystem::temp_directory_path() /
+           ("wavey_audio_buffer_test_" + std::to_string(getpid()) + "_" + name);
+}
+
+// Write |frames| frames of a pattern that differs per frame and channel. Returns false if the
+// format is not supported.
+bool Write(const std::string& path, int format, int num_channels, int64_t frames) {
+    SndfileHandle file(path, SFM_WRITE, format, num_channels, 48000);
+    if (!file)
+        return false;
+    std::vector<short> samples(frames * num_channels);
+    for (size_t i = 0; i < samples.size(); i++) {
+        samples[i] = static_cast<short>(i * 7919 % 65536 - 32768);
+    }
+    return file.writef(samples.data(), frames) == frames;
+}
+
+// A file read through virtual IO, whose seeks fail once it is open.
+struct FailingIo {
+    std::FILE* file = nullptr;
+    bool fail_seeks = false;
+    bool failed = false;
+};
+
+SF_VIRTUAL_IO failing_io = {
+    [](void* io) -> sf_count_t {
+        std::FILE* file = static_cast<FailingIo*>(io)->file;
+        const long position = std::ftell(file);
+        std::fseek(file, 0, SEEK_END);
+        const long length = std::ftell(file);
+        std::fseek(file, position, SEEK_SET);
+        return length;
+    },
+    [](sf_count_t offset, int whence, void* io) -> sf_count_t {
+        FailingIo* f = static_cast<FailingIo*>(io);
+        f->failed = f->fail_seeks;
+        if (f->fail_seeks || std::fseek(f->file, offset, whence) != 0)
+            return -1;
+        return std::ftell(f->file);
+    },
+    [](void* ptr, sf_count_t count, void* io) -> sf_count_t {
+        return std::fread(ptr, 1, count, static_cast<FailingIo*>(io)->file);
+    },
+    [](const void*, sf_count_t, void*) -> sf_count_t { return 0; },
+    [](void* io) -> sf_count_t { return std::ftell(static_cast<FailingIo*>(io)->file); },
+};
+
+// A buffer whose parallel decoders cannot seek, e.g. in a file that changed since it was opened.
+class SeekFailingBuffer : public AudioBuffer {
+   public:
+    using AudioBuffer::AudioBuffer;
+    ~SeekFailingBuffer() override {
+        for (FailingIo& io : ios) {
+            std::fclose(io.file);
+        }
+    }
+    bool SeekFailed() const {
+        std::scoped_lock lock(mutex);
+        return std::any_of(ios.begin(), ios.end(), [](const FailingIo& io) { return io.failed; });
+    }
+
+   protected:
+    std::unique_ptr<SndfileHandle> OpenDecoder() const override {
+        std::scoped_lock lock(mutex);
+        FailingIo& io = ios.emplace_back();
+        io.file = std::fopen(FileName().c_str(), "rb");
+        if (!io.file)
+            return nullptr;
+        auto file = std::make_unique<SndfileHandle>(failing_io, &io);
+        io.fail_seeks = true;
+        return file;
+    }
+
+   private:
+    mutable std::mutex mutex;
+    mutable std::list<FailingIo> ios;
+};
+
+// Load |path| in a task, as the application does, with up to |max_decoders| decoders.
+template <class Buffer = AudioBuffer>
+std::unique_ptr<Buffer> Load(TaskScheduler& scheduler,
+                             const std::string& path,
+                             int max_decoders,
+                             bool* monotonic) {
+    auto buffer = std::make_unique<Buffer>(path);
+    auto loaded =
+        scheduler.Submit(std::make_shared<TaskGroup>(), [&] { buffer->Load({}, max_decoders); });
+    int64_t previous = 0;
+    *monotonic = true;
+    while (loaded.wait_for(std::chrono::milliseconds(0)) != std::future_status::ready) {
+        const int64_t frames = buffer->LoadedFrames();
+        *monotonic = *monotonic && frames >= previous;
+        previous = frames;
+    }
+    loaded.get();
+    return buffer;
+}
+
+size_t SizeOf(const AudioBuffer& buffer) {
+    return buffer.NumFrames() * buffer.NumChannels() *
+           (buffer.Type() == INT16 ? sizeof(int16_t) : sizeof(float));
+}
+
+void TestParallelDecode(TaskScheduler& scheduler, const std::string& path) {
+    bool monotonic;
+    std::unique_ptr<AudioBuffer> sequential = Load(scheduler, path, 1, &monotonic);
+    for (int max_decoders : {3, 0}) {
+        std::unique_ptr<AudioBuffer> parallel = Load(scheduler, path, max_decoders, &monotonic);
+        Check(parallel->Loaded() && parallel->LoadedFrames() == parallel->NumFrames(),
+              "parallel decode is complete");
+        Check(monotonic, "loaded frames only grow");
+        Check(parallel->NumFrames() == sequential->NumFrames() &&
+                  parallel->Type() == sequential->Type() &&
+                  std::memcmp(parallel->Data(), sequential->Data(), SizeOf(*sequential)) == 0,
+              "parallel decode matches sequential decode");
+    }
+
+    // The chunks of decoders that cannot seek are decoded sequentially instead. The decoders race
+    // for the chunks, so load until a seek has failed.
+    for (int attempt = 0; attempt < 20; attempt++) {
+        std::unique_ptr<SeekFailingBuffer> failing =
+            Load<SeekFailingBuffer>(scheduler, path, 3, &monotonic);
+        Check(failing->Loaded() && failing->NumFrames() == sequential->NumFrames() &&
+                  failing->LoadedFrames() == failing->NumFrames(),
+              "decode with failing seeks is complete");
+        Check(monotonic, "loaded frames only grow with failing seeks");
+        Check(std::memcmp(failing->Data(), sequential->Data(), SizeOf(*sequential)) == 0,
+              "decode with failing seeks matches sequential decode");
+        if (failing->SeekFailed())
+            break;
+    }
+}
+
+void TestSampleType(TaskScheduler& scheduler, const std::string& path, SampleType type) {
+    bool monotonic;
+    std::unique_ptr<AudioBuffer> buffer = Load(scheduler, path, 0, &monotonic);
+    Check(buffer->Type() == type, "sample type");
+    SndfileHandle file(path);
+    std::vector<float> expected(file.frames() * file.channels());
+    file.readf(expected.data(), file.frames());
+    std::vector<float> samples(buffer->NumFrames() * buffer->NumChannels());
+    buffer->ReadFloat(0, buffer->NumFrames(), samples.data());
+    Check(samples == expected, "ReadFloat() matches libsndfile");
+}
+}  // namespace
+
+int main() {
+    TaskScheduler scheduler(4);
+
+    // Two and a half chunks of decoding.
+    const std::string flac = TempPath("parallel.flac");
+    if (!Write(flac, SF_FORMAT_FLAC | SF_FORMAT_PCM_16, 2, 5 << 19)) {
+        std::fprintf(stderr, "libsndfile cannot write FLAC\n");
+        std::filesystem::remove(flac);
+        return kSkipped;
+    }
+    TestParallelDecode(scheduler, flac);
+    TestSampleType(scheduler, flac, INT16);
+    std::filesystem::remove(flac);
+
+    struct Case {
+        const char* name;
+        int format;
+        SampleType type;
+    };
+    for (const Case& c : {Case{"u8.wav", SF_FORMAT_WAV | SF_FORMAT_PCM_U8, INT16},
+                          Case{"16.wav", SF_FORMAT_WAV | SF_FORMAT_PCM_16, INT16},
+                          Case{"24.wav", SF_FORMAT_WAV | SF_FORMAT_PCM_24, FLOAT32},
+                          Case{"float.wav", SF_FORMAT_WAV | SF_FORMAT_FLOAT, FLOAT32}}) {
+        const std::string path = TempPath(c.name);
+        Check(Write(path, c.format, 3, 100000), "write WAV");
+        TestSampleType(scheduler, path, c.type);
+        std::filesystem::remove(path);
+    }
+    return status;
+}
@@ -0,0 +1,104 @@
+// A WAV file whose samples are memory-mapped must be played from disk through an AudioStream like
+// any other file that can be streamed, with the same samples as the mapped buffer, and where
+// playback loops back to.
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <sndfile.hh>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audio_buffer.hpp"
+#include "audio_stream.hpp"
+
+namespace {
+int status = 0;
+
+void Check(bool condition, const char* what) {
+    if (!condition) {
+        std::fprintf(stderr, "failed: %s\n", what);
+        status = 1;
+    }
+}
+
+std::string TempPath(const char* name) {
+    return std::filesystem::temp_directory_path() /
+           ("wavey_audio_stream_test_" + std::to_string(getpid()) + "_" + name);
+}
+
+// Read |count| frames from |first_frame| as the callback does. A block that is not read yet, which
+// the callback plays as silence, is waited for. Returns false if it is not read within seconds.
+bool Play(AudioStream& stream, int64_t first_frame, int64_t count, float* dest) {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (!stream.Read(first_frame, count, dest)) {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+}  // namespace
+
+int main() {
+    constexpr int kNumChannels = 3;
+    constexpr int64_t kNumFrames = 12 * AudioStream::kFramesPerBlock + 1000;
+    constexpr int64_t kLoopStart = 20000;
+    constexpr int64_t kFramesPerCallback = 512;
+
+    const std::string path = TempPath("mapped.wav");
+    {
+        SndfileHandle file(path, SFM_WRITE, SF_FORMAT_WAV | SF_FORMAT_PCM_16, kNumChannels, 48000);
+        std::vector<short> samples(kNumFrames * kNumChannels);
+        for (size_t i = 0; i < samples.size(); i++) {
+            samples[i] = static_cast<short>(i * 7919 % 65536 - 32768);
+        }
+        Check(file.writef(samples.data(), kNumFrames) == kNumFrames, "write WAV");
+    }
+
+    auto buffer = std::make_shared<AudioBuffer>(path);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    Check(buffer->SamplesMapped(), "16-bit WAV is mapped");
+#endif
+    // AudioSystem streams every buffer that is streamable.
+    Check(buffer->Streamable(), "mapped buffer is streamed");
+    std::vector<float> expected(kNumFrames * kNumChannels);
+    buffer->ReadFloat(0, kNumFrames, expected.data());
+
+    {
+        AudioStreamReader reader;
+        auto stream = std::make_shared<AudioStream>(path, kNumChannels, kLoopStart, 0);
+        reader.Add(stream);
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (!stream->Ready() && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        Check(stream->Ready(), "stream opened");
+
+        // Once through the file and past its end, and then again from the loop start.
+        const int64_t num_callbacks = kNumFrames / kFramesPerCallback + 2;
+        std::vector<float> played(num_callbacks * kFramesPerCallback * kNumChannels);
+        bool read = true;
+        for (int64_t i = 0; i < num_callbacks; i++) {
+            const int64_t frame = i * kFramesPerCallback;
+            read = read && Play(*stream, frame, kFramesPerCallback, &played[frame * kNumChannels]);
+        }
+        Check(read, "every block is read");
+        Check(std::equal(expected.begin(), expected.end(), played.begin()),
+              "streamed samples match the mapped buffer");
+        Check(std::all_of(played.begin() + expected.size(), played.end(),
+                          [](float x) { return x == 0.f; }),
+              "silence after the end");
+
+        std::vector<float> looped(kFramesPerCallback * kNumChannels);
+        Check(Play(*stream, kLoopStart, kFramesPerCallback, looped.data()) &&
+                  std::equal(looped.begin(), looped.end(),
+                             expected.begin() + kLoopStart * kNumChannels),
+              "loop start is read");
+    }
+    std::filesystem::remove(path);
+    return status;
+}
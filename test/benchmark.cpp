@@ -0,0 +1,401 @@
+// Benchmarks of the performance critical paths. "meson test --benchmark" runs all of them, and
+// "wavey_benchmark <name>" runs one. Build with --buildtype=release for meaningful numbers.
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sndfile.hh>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audio_buffer.hpp"
+#include "audio_mixer.hpp"
+#include "min_max.hpp"
+#include "resampler.hpp"
+#include "task_scheduler.hpp"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+// Exit status that tells meson that a benchmark was skipped.
+constexpr int kSkipped = 77;
+
+// Best time of |repetitions| calls to |function|, in milliseconds.
+template <class F>
+double Time(int repetitions, F function) {
+    double best = 0.0;
+    for (int i = 0; i < repetitions; i++) {
+        const Clock::time_point start = Clock::now();
+        function();
+        const double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        best = i ? std::min(best, ms) : ms;
+    }
+    return best;
+}
+
+std::vector<float> Noise(size_t size, float amplitude = 1.f) {
+    std::mt19937 generator(1);
+    std::uniform_real_distribution<float> distribution(-amplitude, amplitude);
+    std::vector<float> samples(size);
+    for (float& sample : samples) {
+        sample = distribution(generator);
+    }
+    return samples;
+}
+
+// First level of the waveform pyramid for 10 minutes of 48 kHz stereo, spread over the channels,
+// with the scalar reference, the SIMD kernel and the SIMD kernel in parallel chunks as
+// LowResWaveform does.
+int BenchmarkMinMax(const std::vector<std::string>&) {
+    constexpr int kBlockFrames = 16;
+    constexpr int64_t kBlocksPerChunk = 4096;
+    constexpr int64_t kNumSamples = 48000 * 600 * 2;
+    const std::vector<float> samples = Noise(kNumSamples);
+    TaskScheduler scheduler(0);
+    int status = 0;
+    for (int num_channels : {1, 2, 8, 32}) {
+        const int64_t num_frames = kNumSamples / num_channels;
+        const int64_t num_blocks = (num_frames + kBlockFrames - 1) / kBlockFrames;
+        std::vector<float> reference(2 * num_channels * num_blocks);
+        std::vector<float> simd(reference.size());
+        std::vector<float> parallel(reference.size());
+
+        const double scalar_ms = Time(3, [&] {
+            MinMaxBlocksScalar(samples.data(), num_channels, num_frames, kBlockFrames,
+                               reference.data());
+        });
+        const double simd_ms = Time(3, [&] {
+            MinMaxBlocks(samples.data(), num_channels, num_frames, kBlockFrames, simd.data());
+        });
+        const int64_t num_chunks = (num_blocks + kBlocksPerChunk - 1) / kBlocksPerChunk;
+        const double parallel_ms = Time(3, [&] {
+            scheduler
+                .Submit(std::make_shared<TaskGroup>(),
+                        [&] {
+                            TaskScheduler::ParallelFor(num_chunks, [&](int64_t chunk) {
+                                const int64_t block = chunk * kBlocksPerChunk;
+                                const int64_t frames =
+                                    std::min(kBlocksPerChunk * kBlockFrames,
+                                             num_frames - block * kBlockFrames);
+                                MinMaxBlocks(samples.data() + block * kBlockFrames * num_channels,
+                                             num_channels, frames, kBlockFrames,
+                                             &parallel[2 * num_channels * block]);
+                            });
+                        })
+                .get();
+        });
+
+        const bool equal = simd == reference && parallel == reference;
+        std::printf("min_max %2d channels: scalar %6.1f ms, SIMD %6.1f ms (%.1fx), "
+                    "%d threads %6.1f ms (%.1fx)%s\n",
+                    num_channels, scalar_ms, simd_ms, scalar_ms / simd_ms, scheduler.NumThreads(),
+                    parallel_ms, scalar_ms / parallel_ms, equal ? "" : ", MISMATCH");
+        if (!equal) {
+            status = 1;
+        }
+    }
+    return status;
+}
+
+// Peak resident set size of the process so far, in bytes.
+size_t PeakRss() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return usage.ru_maxrss;
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+// Write |num_frames| of a tone with some noise, a block at a time.
+bool WriteTestFile(const std::string& path,
+                   int format,
+                   int num_channels,
+                   int samplerate,
+                   int64_t num_frames) {
+    SndfileHandle file(path, SFM_WRITE, format, num_channels, samplerate);
+    if (!file)
+        return false;
+    constexpr int kFramesPerWrite = 1 << 16;
+    const std::vector<float> noise = Noise(kFramesPerWrite * num_channels, 0.01f);
+    std::vector<float> block(noise.size());
+    for (int64_t frame = 0; frame < num_frames; frame += kFramesPerWrite) {
+        const int64_t frames = std::min<int64_t>(kFramesPerWrite, num_frames - frame);
+        for (int64_t i = 0; i < frames * num_channels; i++) {
+            const int64_t n = frame + i / num_channels;
+            block[i] = 0.5f * std::sin(0.0628f * (n % 100000)) + noise[i];
+        }
+        if (file.writef(block.data(), frames) != frames)
+            return false;
+    }
+    return true;
+}
+
+// Peak RSS while loading 10 minutes of 48 kHz stereo FLAC, compared to the size of the samples in
+// memory. Every load runs in a child process, which starts from the RSS of the parent.
+int BenchmarkPeakRss(const std::vector<std::string>&) {
+    int status = 0;
+    for (const int bits : {16, 24}) {
+        const std::string path = (std::filesystem::temp_directory_path() /
+                                  ("wavey_benchmark_" + std::to_string(getpid()) + ".flac"))
+                                     .string();
+        const int format = SF_FORMAT_FLAC | (bits == 16 ? SF_FORMAT_PCM_16 : SF_FORMAT_PCM_24);
+        if (!WriteTestFile(path, format, 2, 48000, 48000 * 600)) {
+            std::fprintf(stderr, "Failed to write %s\n", path.c_str());
+            std::remove(path.c_str());
+            return 1;
+        }
+
+        std::fflush(stdout);
+        const pid_t pid = fork();
+        if (pid == 0) {
+            const size_t initial_rss = PeakRss();
+            TaskScheduler scheduler(0);
+            AudioBuffer ab(path);
+            const double load_ms = Time(1, [&] {
+                scheduler.Submit(std::make_shared<TaskGroup>(), [&] { ab.Load(); }).get();
+            });
+            const size_t sample_bytes = ab.MemoryUsage();
+            const size_t peak_bytes = PeakRss() - initial_rss;
+            std::printf("peak_rss %d-bit FLAC: %.0f MB of samples loaded in %.0f ms, "
+                        "peak RSS +%.0f MB (%.2fx)\n",
+                        bits, sample_bytes / 1e6, load_ms, peak_bytes / 1e6,
+                        static_cast<double>(peak_bytes) / sample_bytes);
+            std::fflush(stdout);
+            std::_Exit(ab.Loaded() && sample_bytes ? 0 : 1);
+        }
+        int child_status = 0;
+        if (pid < 0 || waitpid(pid, &child_status, 0) != pid || !WIFEXITED(child_status) ||
+            WEXITSTATUS(child_status) != 0) {
+            status = 1;
+        }
+        std::remove(path.c_str());
+    }
+    return status;
+}
+
+// Real-time headroom of the playback resampler, converting 20 seconds of noise in callbacks of 512
+// frames as the audio callback does.
+int BenchmarkResampler(const std::vector<std::string>&) {
+    constexpr int kFramesPerCallback = 512;
+    constexpr int kSeconds = 20;
+    struct Rates {
+        int input;
+        int output;
+    };
+    for (const Rates rates : {Rates{44100, 48000}, Rates{48000, 44100}}) {
+        for (const int num_channels : {2, 32}) {
+            Resampler resampler(num_channels, rates.input, rates.output, kFramesPerCallback);
+            const std::vector<float> input =
+                Noise(resampler.MaxInputFrames() * num_channels, 0.5f);
+            std::vector<float> output(kFramesPerCallback * num_channels);
+            const int num_callbacks = kSeconds * rates.output / kFramesPerCallback;
+            const double ms = Time(3, [&] {
+                resampler.Reset();
+                for (int i = 0; i < num_callbacks; i++) {
+                    resampler.Process(input.data(), output.data(), kFramesPerCallback);
+                }
+            });
+            const double callback_ms = 1e3 * kFramesPerCallback / rates.output;
+            std::printf("resampler %5d -> %5d Hz, %2d channels: %.1f us per callback of %.1f ms, "
+                        "%.0fx real time\n",
+                        rates.input, rates.output, num_channels, 1e3 * ms / num_callbacks,
+                        callback_ms, 1e3 * kSeconds / ms);
+        }
+    }
+    return 0;
+}
+
+// The mixer per callback of 512 frames from 32 channels to stereo, with every channel routed and
+// with one channel soloed, against a plain loop over the routing matrix with the gain applied per
+// sample.
+int BenchmarkMixer(const std::vector<std::string>&) {
+    constexpr int kFramesPerCallback = 512;
+    constexpr int kNumCallbacks = 2000;
+    constexpr int kInputs = 32;
+    constexpr int kOutputs = 2;
+    constexpr float kGain = 0.5f;
+    const std::vector<float> input = Noise(kFramesPerCallback * kInputs);
+    std::vector<float> output(kFramesPerCallback * kOutputs);
+    std::vector<float> expected(kFramesPerCallback * kOutputs);
+    int status = 0;
+    for (const int solo : {-1, 5}) {
+        // Routing as set up by AudioMixer: input channel m to output m % 2, or only the soloed
+        // channel to both outputs.
+        std::vector<float> routing(kOutputs * kInputs, 0.f);
+        for (int m = 0; m < kInputs; m++) {
+            for (int o = 0; o < kOutputs; o++) {
+                routing[o * kInputs + m] = solo < 0 ? m % kOutputs == o : m == solo;
+            }
+        }
+        auto reference = [&] {
+            for (int n = 0; n < kFramesPerCallback; n++) {
+                for (int o = 0; o < kOutputs; o++) {
+                    float sum = 0.f;
+                    for (int m = 0; m < kInputs; m++) {
+                        sum += routing[o * kInputs + m] * kGain * input[n * kInputs + m];
+                    }
+                    expected[n * kOutputs + o] = sum;
+                }
+            }
+        };
+        AudioMixer mixer(kInputs, kOutputs);
+        if (solo >= 0) {
+            mixer.Solo(solo);
+        }
+        mixer.Gain(kGain);
+        const double reference_ms = Time(3, [&] {
+            for (int i = 0; i < kNumCallbacks; i++) {
+                reference();
+            }
+        });
+        const double mixer_ms = Time(3, [&] {
+            for (int i = 0; i < kNumCallbacks; i++) {
+                mixer.Mix(input.data(), output.data(), kFramesPerCallback);
+            }
+        });
+        float max_error = 0.f;
+        for (size_t i = 0; i < output.size(); i++) {
+            max_error = std::max(max_error, std::abs(output[i] - expected[i]));
+        }
+        if (max_error > 1e-5f) {
+            std::fprintf(stderr, "mixer %s: max error %g\n", solo < 0 ? "generic" : "solo",
+                         max_error);
+            status = 1;
+        }
+        std::printf("mixer %d -> %d channels, %-7s: %.2f us per callback, reference %.2f us, "
+                    "%.1fx\n",
+                    kInputs, kOutputs, solo < 0 ? "generic" : "solo",
+                    1e3 * mixer_ms / kNumCallbacks, 1e3 * reference_ms / kNumCallbacks,
+                    reference_ms / mixer_ms);
+    }
+    return status;
+}
+
+// CPU time of process |pid| in seconds, or a negative value if it is gone.
+double CpuSeconds(pid_t pid) {
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string line;
+    if (!std::getline(stat, line) || line.rfind(')') == std::string::npos)
+        return -1.0;
+    // User and system time are fields 14 and 15. The name in field 2 may contain spaces.
+    std::istringstream fields(line.substr(line.rfind(')') + 2));
+    std::string field;
+    for (int i = 3; i < 14; i++) {
+        fields >> field;
+    }
+    long long user_ticks = 0;
+    long long system_ticks = 0;
+    fields >> user_ticks >> system_ticks;
+    return static_cast<double>(user_ticks + system_ticks) / sysconf(_SC_CLK_TCK);
+}
+
+// CPU usage of wavey, given as the argument, while it shows a loaded file and nothing happens.
+// Needs a display and /proc.
+int BenchmarkIdleCpu(const std::vector<std::string>& args) {
+    constexpr int kSettleSeconds = 10;
+    constexpr int kMeasureSeconds = 10;
+    if (args.empty()) {
+        std::printf("idle_cpu: skipped, needs the path of wavey\n");
+        return kSkipped;
+    }
+    if (!std::getenv("DISPLAY") && !std::getenv("WAYLAND_DISPLAY")) {
+        std::printf("idle_cpu: skipped, no display\n");
+        return kSkipped;
+    }
+    if (!std::filesystem::exists("/proc/self/stat")) {
+        std::printf("idle_cpu: skipped, no /proc\n");
+        return kSkipped;
+    }
+
+    // The file and the analysis cache of the run are kept in a directory of their own.
+    const std::filesystem::path directory =
+        std::filesystem::temp_directory_path() / ("wavey_benchmark_" + std::to_string(getpid()));
+    std::filesystem::create_directories(directory);
+    const std::string path = (directory / "idle.wav").string();
+    if (!WriteTestFile(path, SF_FORMAT_WAV | SF_FORMAT_PCM_16, 2, 48000, 48000 * 120)) {
+        std::fprintf(stderr, "Failed to write %s\n", path.c_str());
+        std::filesystem::remove_all(directory);
+        return 1;
+    }
+
+    const pid_t pid = fork();
+    if (pid == 0) {
+        setenv("XDG_CACHE_HOME", directory.c_str(), 1);
+        execl(args[0].c_str(), args[0].c_str(), "--detach", path.c_str(), nullptr);
+        std::_Exit(127);
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(kSettleSeconds));
+    const double start = CpuSeconds(pid);
+    std::this_thread::sleep_for(std::chrono::seconds(kMeasureSeconds));
+    const double end = CpuSeconds(pid);
+    int child_status = 0;
+    const bool running = pid > 0 && waitpid(pid, &child_status, WNOHANG) == 0;
+    int status = 0;
+    if (running && start >= 0.0 && end >= 0.0) {
+        std::printf("idle_cpu: %.2f%% of a core over %d s with one file shown\n",
+                    100.0 * (end - start) / kMeasureSeconds, kMeasureSeconds);
+    } else {
+        std::fprintf(stderr, "idle_cpu: %s exited early\n", args[0].c_str());
+        status = 1;
+    }
+
+    if (running) {
+        kill(pid, SIGTERM);
+        for (int i = 0; i < 50 && waitpid(pid, &child_status, WNOHANG) == 0; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        if (waitpid(pid, &child_status, WNOHANG) == 0) {
+            kill(pid, SIGKILL);
+            waitpid(pid, &child_status, 0);
+        }
+    }
+    std::filesystem::remove_all(directory);
+    return status;
+}
+
+struct Benchmark {
+    const char* name;
+    int (*function)(const std::vector<std::string>& args);
+};
+
+constexpr Benchmark kBenchmarks[] = {
+    {"min_max", BenchmarkMinMax},
+    {"peak_rss", BenchmarkPeakRss},
+    {"idle_cpu", BenchmarkIdleCpu},
+    {"resampler", BenchmarkResampler},
+    {"mixer", BenchmarkMixer},
+};
+}  // namespace
+
+int main(int argc, char** argv) {
+    const std::vector<std::string> args(argv + std::min(argc, 2), argv + argc);
+    if (argc >= 2) {
+        for (const Benchmark& benchmark : kBenchmarks) {
+            if (std::strcmp(argv[1], benchmark.name) == 0)
+                return benchmark.function(args);
+        }
+        std::fprintf(stderr, "Unknown benchmark %s\n", argv[1]);
+        return 1;
+    }
+    int status = 0;
+    for (const Benchmark& benchmark : kBenchmarks) {
+        const int result = benchmark.function(args);
+        status |= result == kSkipped ? 0 : result;
+    }
+    return status;
+}
@@ -0,0 +1,56 @@
+// PowerToDb16 must be within one quantization step of the exact PowerToDb16Scalar, for every
+// number of bins, i.e. also in the tail that does not fill a vector.
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "power_db.hpp"
+
+int main() {
+    std::mt19937 generator(1);
+    // Magnitudes from far below kPowerDbMin to far above kPowerDbMax.
+    std::uniform_real_distribution<float> level_db(-160.f, 20.f);
+    std::uniform_real_distribution<float> unit(-1.f, 1.f);
+    std::uniform_real_distribution<float> scale_db(-80.f, 0.f);
+
+    int max_error = 0;
+    std::vector<int> bins;
+    for (int num_bins = 1; num_bins <= 40; num_bins++) {
+        bins.push_back(num_bins);
+    }
+    bins.insert(bins.end(), {257, 513, 1025, 4097});
+    for (int num_bins : bins) {
+        std::vector<float> spectrum(2 * num_bins);
+        std::vector<uint16_t> fast(num_bins);
+        std::vector<uint16_t> exact(num_bins);
+        for (int iteration = 0; iteration < 200; iteration++) {
+            const float scale = std::pow(10.f, scale_db(generator) / 20.f);
+            for (float& x : spectrum) {
+                x = unit(generator) * std::pow(10.f, level_db(generator) / 20.f);
+            }
+            // Silence and single zero bins.
+            if (iteration == 0) {
+                std::fill(spectrum.begin(), spectrum.end(), 0.f);
+            } else if (iteration % 10 == 0) {
+                spectrum[2 * (iteration % num_bins)] = 0.f;
+                spectrum[2 * (iteration % num_bins) + 1] = 0.f;
+            }
+
+            PowerToDb16(spectrum.data(), num_bins, scale, fast.data());
+            PowerToDb16Scalar(spectrum.data(), num_bins, scale, exact.data());
+            for (int k = 0; k < num_bins; k++) {
+                const int error = std::abs(fast[k] - exact[k]);
+                if (error > 1) {
+                    std::fprintf(stderr, "%d bins, bin %d: %d, expected %d\n", num_bins, k,
+                                 fast[k], exact[k]);
+                }
+                max_error = std::max(max_error, error);
+            }
+        }
+    }
+    std::printf("Max error %d quantization steps\n", max_error);
+    return max_error > 1 ? 1 : 0;
+}
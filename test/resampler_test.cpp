@@ -0,0 +1,83 @@
+// A sine through the Resampler must come out as the same sine at the output rate, also when the
+// number of frames per call varies, and what is above the output Nyquist frequency must be
+// removed.
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "resampler.hpp"
+
+namespace {
+constexpr double kPi = 3.14159265358979323846;
+
+// Resample two seconds of a sine of |frequency| Hz on the first channel and its negation on the
+// second. Returns the largest error against the ideal sine at the output rate if |rms| is null,
+// and stores the RMS of the output otherwise. The first 100 ms are skipped, since the filter
+// starts from silence.
+double Run(int input_rate, int output_rate, double frequency, double* rms = nullptr) {
+    constexpr int kMaxOutputFrames = 512;
+    Resampler resampler(2, input_rate, output_rate, kMaxOutputFrames);
+    std::vector<float> input(2 * resampler.MaxInputFrames());
+    std::vector<float> output(2 * kMaxOutputFrames);
+    int64_t input_frame = 0;
+    int64_t output_frame = 0;
+    double max_error = 0.0;
+    double sum_squares = 0.0;
+    int64_t count = 0;
+    while (output_frame < 2 * output_rate) {
+        const int frames = 1 + (output_frame * 7919) % kMaxOutputFrames;
+        const int64_t needed = resampler.InputFramesNeeded(frames);
+        for (int64_t i = 0; i < needed; i++) {
+            const float x = std::sin(2 * kPi * frequency * (input_frame + i) / input_rate);
+            input[2 * i] = x;
+            input[2 * i + 1] = -x;
+        }
+        input_frame += needed;
+        resampler.Process(input.data(), output.data(), frames);
+
+        for (int i = 0; i < frames; i++) {
+            const int64_t n = output_frame + i;
+            if (output[2 * i] != -output[2 * i + 1])
+                return 1.0;
+            if (n < output_rate / 10)
+                continue;
+            const double expected = std::sin(2 * kPi * frequency * n / output_rate);
+            max_error = std::max(max_error, std::abs(output[2 * i] - expected));
+            sum_squares += output[2 * i] * output[2 * i];
+            count++;
+        }
+        output_frame += frames;
+    }
+    if (rms)
+        *rms = std::sqrt(sum_squares / count);
+    return max_error;
+}
+}  // namespace
+
+int main() {
+    int status = 0;
+    struct Case {
+        int input_rate;
+        int output_rate;
+        double frequency;
+    };
+    for (const Case& c : {Case{44100, 48000, 1000}, Case{48000, 44100, 1000},
+                          Case{96000, 44100, 15000}, Case{48000, 48000 * 3, 10000}}) {
+        const double error = Run(c.input_rate, c.output_rate, c.frequency);
+        std::printf("%d -> %d Hz, %.0f Hz sine: max error %g\n", c.input_rate, c.output_rate,
+                    c.frequency, error);
+        if (error > 1e-3)
+            status = 1;
+    }
+
+    // A 30 kHz sine is above the Nyquist frequency of 44.1 kHz and must be attenuated.
+    double rms = 0.0;
+    Run(96000, 44100, 30000, &rms);
+    const double level_db = 20 * std::log10(rms * std::sqrt(2.0));
+    std::printf("96000 -> 44100 Hz, 30000 Hz sine: %.1f dB\n", level_db);
+    if (level_db > -60.0)
+        status = 1;
+    return status;
+}
@@ -0,0 +1,82 @@
+// The eviction plan must get within both budgets by evicting the least recently viewed tracks first,
+// never evict pinned tracks, and evict no more than needed. Spectrogram tiles must get what the
+// other resources leave, the most recently viewed tracks first.
+#include <cstdio>
+#include <vector>
+
+#include "resource_manager.hpp"
+
+namespace {
+int status = 0;
+
+void Check(bool condition, const char* what) {
+    if (!condition) {
+        std::fprintf(stderr, "failed: %s\n", what);
+        status = 1;
+    }
+}
+
+ResourceManager::Resident Track(size_t cpu_bytes,
+                                size_t gpu_bytes,
+                                uint64_t last_viewed,
+                                bool pinned = false) {
+    ResourceManager::Resident r;
+    r.cpu_bytes = cpu_bytes;
+    r.gpu_bytes = gpu_bytes;
+    r.last_viewed = last_viewed;
+    r.pinned = pinned;
+    return r;
+}
+
+ResourceManager::Resident Tiles(size_t cpu_bytes,
+                                size_t cpu_tile_bytes,
+                                size_t gpu_tile_bytes,
+                                uint64_t last_viewed) {
+    ResourceManager::Resident r = Track(cpu_bytes + cpu_tile_bytes, gpu_tile_bytes, last_viewed);
+    r.cpu_tile_bytes = cpu_tile_bytes;
+    r.gpu_tile_bytes = gpu_tile_bytes;
+    return r;
+}
+}  // namespace
+
+int main() {
+    using Plan = std::vector<ResourceManager::Eviction>;
+    constexpr auto KEEP = ResourceManager::KEEP;
+    constexpr auto EVICT_GPU = ResourceManager::EVICT_GPU;
+    constexpr auto EVICT_ALL = ResourceManager::EVICT_ALL;
+
+    // Within budget.
+    ResourceManager manager(100, 50);
+    Check(manager.Plan({Track(60, 30, 1), Track(40, 20, 2)}) == Plan({KEEP, KEEP}),
+          "nothing evicted within budget");
+    Check(manager.CpuUsage() == 100 && manager.GpuUsage() == 50, "usage");
+
+    // Over the CPU budget, the least recently viewed track goes first, and its GPU memory with it.
+    Check(manager.Plan({Track(40, 20, 3), Track(40, 20, 1), Track(40, 20, 2)}) ==
+              Plan({KEEP, EVICT_ALL, KEEP}),
+          "least recently viewed evicted first");
+
+    // Pinned tracks are kept even if that stays over budget.
+    Check(manager.Plan({Track(80, 0, 1, true), Track(80, 0, 2)}) == Plan({KEEP, EVICT_ALL}),
+          "pinned track kept");
+    Check(manager.Plan({Track(200, 0, 1, true)}) == Plan({KEEP}), "pinned track over budget");
+
+    // Over the GPU budget only, only GPU memory is evicted, and tracks without any are skipped.
+    Check(manager.Plan({Track(10, 0, 1), Track(10, 40, 2), Track(10, 40, 3)}) ==
+              Plan({KEEP, EVICT_GPU, KEEP}),
+          "only GPU memory evicted");
+
+    // Evicting a track for CPU memory can bring the GPU memory within budget as well.
+    Check(manager.Plan({Track(60, 40, 1), Track(60, 40, 2)}) == Plan({EVICT_ALL, KEEP}),
+          "CPU eviction frees GPU memory");
+
+    // Tiles get what the other resources leave, minus the tiles of more recently viewed tracks.
+    using Budgets = std::vector<ResourceManager::TileBudget>;
+    Check(manager.TileBudgets({Tiles(10, 30, 20, 1), Tiles(20, 40, 10, 3), Tiles(0, 0, 5, 2)}) ==
+              Budgets({{30, 35}, {70, 50}, {30, 40}}),
+          "tile budgets by last view");
+    Check(manager.TileBudgets({Tiles(60, 0, 0, 1), Tiles(60, 10, 0, 2)}) ==
+              Budgets({{0, 50}, {0, 50}}),
+          "no tile budget over budget");
+    return status;
+}
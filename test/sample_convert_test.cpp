@@ -0,0 +1,55 @@
+// Int16ToFloat() must convert every 16-bit value exactly as libsndfile does, and AddScaled() must
+// match a plain loop, for every length, i.e. also in the tail that does not fill a vector.
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "sample_convert.hpp"
+
+int main() {
+    int status = 0;
+
+    // Every value, at every offset within a vector.
+    for (int shift = 0; shift < 17; shift++) {
+        std::vector<int16_t> samples(65536 + shift);
+        for (size_t i = 0; i < samples.size(); i++) {
+            samples[i] = static_cast<int16_t>(i - shift);
+        }
+        std::vector<float> converted(samples.size());
+        Int16ToFloat(samples.data(), samples.size(), converted.data());
+        for (size_t i = 0; i < samples.size(); i++) {
+            if (converted[i] != samples[i] / 32768.f) {
+                std::fprintf(stderr, "Int16ToFloat(%d) = %g\n", samples[i], converted[i]);
+                status = 1;
+                break;
+            }
+        }
+    }
+
+    // Every length up to a few vectors, leaving what follows untouched.
+    for (size_t length = 0; length <= 64; length++) {
+        std::vector<int16_t> samples(length);
+        for (size_t i = 0; i < length; i++) {
+            samples[i] = static_cast<int16_t>(i * 2003 - 32768);
+        }
+        std::vector<float> converted(length + 1, 2.f);
+        Int16ToFloat(samples.data(), length, converted.data());
+        std::vector<float> sum(length + 1, 0.25f);
+        std::vector<float> expected = sum;
+        AddScaled(converted.data(), 0.3f, length, sum.data());
+        for (size_t i = 0; i < length; i++) {
+            expected[i] += converted[i] * 0.3f;
+        }
+        bool equal = converted[length] == 2.f;
+        for (size_t i = 0; i <= length; i++) {
+            equal = equal && std::abs(sum[i] - expected[i]) <= 1e-6f;
+            equal = equal && (i == length || converted[i] == samples[i] / 32768.f);
+        }
+        if (!equal) {
+            std::fprintf(stderr, "length %zu differs\n", length);
+            status = 1;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,52 @@
+// Items must arrive in order and exactly once between a producer and a consumer thread, and the
+// queue must hold N - 1 items.
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+
+#include "spsc_queue.hpp"
+
+int main() {
+    int status = 0;
+
+    SpscQueue<int, 4> small;
+    int item = 0;
+    const bool filled = small.Push(1) && small.Push(2) && small.Push(3) && !small.Push(4);
+    const bool drained = small.Pop(&item) && item == 1 && small.Push(4) && small.Pop(&item) &&
+                         item == 2 && small.Pop(&item) && item == 3 && small.Pop(&item) &&
+                         item == 4 && !small.Pop(&item);
+    if (!filled || !drained) {
+        std::fprintf(stderr, "failed: capacity and order\n");
+        status = 1;
+    }
+
+    // A small queue wraps around many times and is often full and empty.
+    constexpr int64_t kCount = 1000000;
+    SpscQueue<int64_t, 8> queue;
+    std::thread producer([&] {
+        for (int64_t i = 0; i < kCount;) {
+            if (queue.Push(i)) {
+                i++;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+    int64_t expected = 0;
+    while (expected < kCount) {
+        int64_t value;
+        if (!queue.Pop(&value)) {
+            std::this_thread::yield();
+            continue;
+        }
+        if (value != expected) {
+            std::fprintf(stderr, "failed: got %lld, expected %lld\n", static_cast<long long>(value),
+                         static_cast<long long>(expected));
+            status = 1;
+            expected = value;
+        }
+        expected++;
+    }
+    producer.join();
+    return status;
+}
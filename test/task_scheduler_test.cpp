@@ -0,0 +1,155 @@
+// Tasks must run in order of background, group priority and submission, cancelled groups must drop
+// their queued tasks and stop their running ones, and ParallelFor() must make every call exactly
+// once.
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "task_scheduler.hpp"
+
+namespace {
+int status = 0;
+
+void Check(bool condition, const char* what) {
+    if (!condition) {
+        std::fprintf(stderr, "failed: %s\n", what);
+        status = 1;
+    }
+}
+
+// Whether |future| was broken because its task was dropped.
+template <class T>
+bool Broken(std::future<T>& future) {
+    try {
+        future.get();
+    } catch (const std::future_error& error) {
+        return error.code() == std::future_errc::broken_promise;
+    }
+    return false;
+}
+
+void TestOrder() {
+    TaskScheduler scheduler(1);
+    auto selected = std::make_shared<TaskGroup>();
+    selected->SetPriority(SELECTED);
+    auto visible = std::make_shared<TaskGroup>();
+    visible->SetPriority(VISIBLE);
+    auto hidden = std::make_shared<TaskGroup>();
+    // A child follows the priority of its parent.
+    auto child = std::make_shared<TaskGroup>(selected);
+
+    // The only worker waits until everything is queued.
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    auto blocker = scheduler.Submit(hidden, [opened] { opened.wait(); });
+
+    std::mutex mutex;
+    std::vector<int> order;
+    std::vector<std::future<void>> futures;
+    auto submit = [&](std::shared_ptr<TaskGroup> group, int id, bool background = false) {
+        futures.push_back(scheduler.Submit(
+            std::move(group),
+            [&, id] {
+                std::scoped_lock lock(mutex);
+                order.push_back(id);
+            },
+            background));
+    };
+    submit(selected, 6, true);
+    submit(hidden, 4);
+    submit(visible, 3);
+    submit(child, 1);
+    submit(hidden, 5);
+    submit(selected, 2);
+    gate.set_value();
+    blocker.get();
+    for (std::future<void>& future : futures) {
+        future.get();
+    }
+    Check(order == std::vector<int>({1, 2, 3, 4, 5, 6}), "priority order");
+}
+
+void TestCancel() {
+    TaskScheduler scheduler(1);
+    auto group = std::make_shared<TaskGroup>();
+    auto parent = std::make_shared<TaskGroup>();
+    auto child = std::make_shared<TaskGroup>(parent);
+
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    auto blocker = scheduler.Submit(group, [opened] { opened.wait(); });
+    std::atomic<int> runs{0};
+    auto kept = scheduler.Submit(group, [&] { return ++runs; });
+    auto dropped = scheduler.Submit(child, [&] { return ++runs; });
+    Check(scheduler.QueueDepth() == 3, "queue depth");
+
+    // Cancelling the parent drops the queued task of the child.
+    scheduler.Cancel(*parent);
+    Check(child->Cancelled(), "child cancelled with parent");
+    Check(Broken(dropped), "dropped task breaks its future");
+    gate.set_value();
+    blocker.get();
+    Check(kept.get() == 1 && runs == 1, "other groups still run");
+}
+
+void TestCancellationToken() {
+    TaskScheduler scheduler(1);
+    auto parent = std::make_shared<TaskGroup>();
+    auto group = std::make_shared<TaskGroup>(parent);
+    Check(!CancellationToken().Cancelled(), "default token");
+
+    // A running task polls the token of its group until the parent is cancelled.
+    std::promise<void> started;
+    auto running = scheduler.Submit(group, [&, token = CancellationToken(group)] {
+        started.set_value();
+        int64_t polls = 0;
+        while (!token.Cancelled()) {
+            polls++;
+        }
+        return polls;
+    });
+    started.get_future().wait();
+    scheduler.Cancel(*parent);
+    Check(running.wait_for(std::chrono::seconds(10)) == std::future_status::ready,
+          "running task stops when cancelled");
+}
+
+void TestParallelFor() {
+    TaskScheduler scheduler(4);
+    constexpr int64_t kCount = 10000;
+    std::vector<std::atomic<int>> calls(kCount);
+    auto group = std::make_shared<TaskGroup>();
+    scheduler
+        .Submit(group,
+                [&] {
+                    TaskScheduler::ParallelFor(kCount, [&](int64_t i) { calls[i]++; });
+                    // Nested calls from inside a part.
+                    TaskScheduler::ParallelFor(10, [&](int64_t i) {
+                        TaskScheduler::ParallelFor(10, [&](int64_t j) { calls[i * 10 + j]++; });
+                    });
+                })
+        .get();
+    bool once = true;
+    for (int64_t i = 0; i < kCount; i++) {
+        once = once && calls[i] == (i < 100 ? 2 : 1);
+    }
+    Check(once, "ParallelFor() in a task calls every index once");
+
+    // Outside of a task, the calls are made in order on this thread.
+    std::vector<int64_t> order;
+    TaskScheduler::ParallelFor(5, [&](int64_t i) { order.push_back(i); });
+    Check(order == std::vector<int64_t>({0, 1, 2, 3, 4}), "ParallelFor() outside of a task");
+}
+}  // namespace
+
+int main() {
+    TestOrder();
+    TestCancel();
+    TestCancellationToken();
+    TestParallelFor();
+    return status;
+}
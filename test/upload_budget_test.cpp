@@ -0,0 +1,29 @@
+// An upload budget must hand out whole units until the bytes of the frame are used up, and start
+// over with every frame.
+#include <cstdio>
+
+#include "upload_budget.hpp"
+
+int main() {
+    int status = 0;
+    auto check = [&](bool condition, const char* what) {
+        if (!condition) {
+            std::fprintf(stderr, "failed: %s\n", what);
+            status = 1;
+        }
+    };
+
+    UploadBudget budget(1000);
+    check(budget.Exhausted(), "empty before the first frame");
+    budget.NewFrame();
+    check(budget.Take(3, 100) == 3, "units within budget");
+    check(budget.Take(10, 300) == 2, "only whole units");
+    check(budget.Take(1, 200) == 0 && !budget.Exhausted(), "less than a unit left");
+    check(budget.Take(100, 1) == 100 && budget.Exhausted(), "rest of the budget");
+    check(budget.Take(1, 1) == 0 && budget.Take(0, 1) == 0, "nothing left");
+    budget.NewFrame();
+    check(budget.Take(1, 1000) == 1, "new frame");
+    budget.NewFrame();
+    check(budget.Take(1, 1001) == 0, "unit larger than the budget");
+    return status;
+}